@@ -0,0 +1,1238 @@
+// Sudoku Bench.cpp : Benchmarks for the solver. Puzzles are read into memory before anything is timed.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AsyncSolver.h"
+#include "BatchSolver.h"
+#include "Canonical.h"
+#include "DigitCounts.h"
+#include "Generator.h"
+#include "PuzzleBinary.h"
+#include "PuzzleText.h"
+#include "SolutionCache.h"
+#include "Solver.h"
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "SolveServer.h"
+#endif
+
+// Every heap allocation the program makes goes through here, so the allocations benchmark can count them and the scaling
+// benchmark can see how much memory is in use. Each block starts with its size so delete can take it off again. The
+// array forms of new and delete call these by default.
+static std::atomic<long long> heapAllocations(0);
+static std::atomic<long long> heapBytes(0);
+static std::atomic<long long> heapPeak(0);
+static const size_t heapHeader = 16; // keeps blocks as aligned as malloc makes them
+
+void* operator new(size_t size) {
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	char* block = (char*)malloc(size + heapHeader);
+	if (block == NULL) throw std::bad_alloc();
+	*(size_t*)block = size;
+	long long bytes = heapBytes.fetch_add((long long)size, std::memory_order_relaxed) + (long long)size;
+	long long peak = heapPeak.load(std::memory_order_relaxed);
+	while (bytes > peak && !heapPeak.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {}
+	return block + heapHeader;
+}
+
+void operator delete(void* p) noexcept {
+	if (p == NULL) return;
+	// Worked out as a number, as the compiler can't see that p came from operator new above and warns of reading before it
+	char* block = (char*)((uintptr_t)p - heapHeader);
+	heapBytes.fetch_sub((long long)*(size_t*)block, std::memory_order_relaxed);
+	free(block);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+struct BenchOptions {
+	int boxWidth = 0;
+	int boxHeight = 0;
+	CellEncoding encoding = DigitEncoding;
+	int threads = 0;
+	int repeat = 1;
+	const char* path = NULL;
+};
+
+// Puzzles from a file, one per line
+struct Corpus {
+	int boxWidth = 0;
+	int boxHeight = 0;
+	std::vector<std::string> lines;
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool loadCorpus(const BenchOptions& options, Corpus& corpus) {
+	FILE* file = fopen(options.path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open '%s'\n", options.path);
+		return false;
+	}
+
+	LineReader reader(file);
+	const char* text;
+	size_t length;
+	bool tooLong;
+	while (reader.next(text, length, tooLong)) {
+		while (length > 0 && (text[length - 1] == ' ' || text[length - 1] == '\t' || text[length - 1] == '\r')) length--;
+		if (length == 0 || text[0] == '#' || tooLong) continue;
+		corpus.lines.push_back(std::string(text, length));
+	}
+	fclose(file);
+
+	if (corpus.lines.empty()) {
+		fprintf(stderr, "No puzzles in '%s'\n", options.path);
+		return false;
+	}
+
+	corpus.boxWidth = options.boxWidth;
+	corpus.boxHeight = options.boxHeight;
+	if (corpus.boxWidth == 0) {
+		// Square boxes worked out from the first puzzle
+		int size = (int)std::lround(std::sqrt((double)corpus.lines[0].size()));
+		corpus.boxWidth = corpus.boxHeight = (int)std::lround(std::sqrt((double)size));
+	}
+	return true;
+}
+
+// Puzzles per second at every number of threads from 1 up to the number of cores (or -j)
+static int benchThreads(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	int maxThreads = options.threads > 0 ? options.threads : defaultBatchThreads();
+	size_t total = corpus.lines.size() * options.repeat;
+	printf("%zu puzzles, %dx%d boxes\n", total, corpus.boxWidth, corpus.boxHeight);
+	printf("threads  puzzles/s  speedup\n");
+
+	double single = 0;
+	for (int threads = 1; threads <= maxThreads; threads++) {
+		size_t read = 0, solved = 0;
+		auto next = [&](BatchItem& item) {
+			if (read == total) return false;
+			const std::string& line = corpus.lines[read++ % corpus.lines.size()];
+			item.valid = parsePuzzle(line.data(), line.size(), options.encoding, item.shape(corpus.boxWidth, corpus.boxHeight));
+			return true;
+		};
+		auto done = [&](BatchItem& item) {
+			if (item.valid) solved++;
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		solveBatch(threads, 0, next, done);
+		double seconds = secondsSince(start);
+
+		double rate = seconds > 0 ? solved / seconds : 0;
+		if (threads == 1) single = rate;
+		printf("%7d  %9.0f  %7.2f\n", threads, rate, single > 0 ? rate / single : 0.0);
+	}
+	return 0;
+}
+
+// Time to solve each puzzle on its own using 1 up to N threads inside the search
+static int benchParallel(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	int maxThreads = options.threads > 0 ? options.threads : defaultBatchThreads();
+	Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+	printf("%zu puzzles, %dx%d boxes, split depth %d\n", corpus.lines.size(), corpus.boxWidth, corpus.boxHeight, SolveOptions().splitDepth);
+	printf("threads  mean ms  worst ms  speedup\n");
+
+	double single = 0;
+	for (int threads = 1; threads <= maxThreads; threads++) {
+		SolveOptions solveOptions;
+		solveOptions.threads = threads;
+
+		double total = 0, worst = 0;
+		for (int r = 0; r < options.repeat; r++) {
+			for (const std::string& line : corpus.lines) {
+				if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+				auto start = std::chrono::steady_clock::now();
+				Solve(sudoku, solveOptions);
+				double seconds = secondsSince(start);
+				total += seconds;
+				if (seconds > worst) worst = seconds;
+			}
+		}
+
+		double mean = total / (corpus.lines.size() * options.repeat);
+		if (threads == 1) single = mean;
+		printf("%7d  %7.3f  %8.3f  %7.2f\n", threads, mean * 1000, worst * 1000, mean > 0 ? single / mean : 0.0);
+	}
+	return 0;
+}
+
+// Puzzles per second on one thread for each solve mode, i.e. what stopping sooner saves
+static int benchModes(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	struct Mode {
+		const char* name;
+		SolveMode mode;
+		int limit;
+	};
+	static const Mode modes[] = {
+		{ "any", FindAny, 0 },
+		{ "unique", ProveUnique, 0 },
+		{ "count 100", CountUpTo, 100 },
+		{ "count 10000", CountUpTo, 10000 },
+	};
+
+	Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+	printf("%zu puzzles, %dx%d boxes\n", corpus.lines.size() * options.repeat, corpus.boxWidth, corpus.boxHeight);
+	printf("mode         puzzles/s  solutions\n");
+
+	for (const Mode& mode : modes) {
+		SolveOptions solveOptions;
+		solveOptions.mode = mode.mode;
+		solveOptions.limit = mode.limit;
+
+		long long solutions = 0;
+		size_t solved = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < options.repeat; r++) {
+			for (const std::string& line : corpus.lines) {
+				if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+				solutions += Solve(sudoku, solveOptions);
+				solved++;
+			}
+		}
+		double seconds = secondsSince(start);
+		printf("%-11s  %9.0f  %9lld\n", mode.name, seconds > 0 ? solved / seconds : 0.0, solutions);
+	}
+	return 0;
+}
+
+// Puzzles per second on one thread with each engine, checking they agree on the number of solutions
+static int benchEngines(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	struct Engine {
+		const char* name;
+		SolveEngine engine;
+	};
+	static const Engine engines[] = {
+		{ "rules", RuleEngine },
+		{ "dlx", DancingLinksEngine },
+	};
+	const size_t numberOfEngines = sizeof(engines) / sizeof(engines[0]);
+
+	Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+	std::vector<int> results[numberOfEngines];
+	printf("%zu puzzles, %dx%d boxes\n", corpus.lines.size() * options.repeat, corpus.boxWidth, corpus.boxHeight);
+	printf("engine  puzzles/s  mean ms  worst ms\n");
+
+	for (size_t e = 0; e < numberOfEngines; e++) {
+		SolveOptions solveOptions;
+		solveOptions.engine = engines[e].engine;
+
+		double total = 0, worst = 0;
+		size_t solved = 0;
+		for (int r = 0; r < options.repeat; r++) {
+			for (const std::string& line : corpus.lines) {
+				if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+				auto start = std::chrono::steady_clock::now();
+				int numberOfSolutions = Solve(sudoku, solveOptions);
+				double seconds = secondsSince(start);
+				total += seconds;
+				if (seconds > worst) worst = seconds;
+				if (r == 0) results[e].push_back(numberOfSolutions);
+				solved++;
+			}
+		}
+		printf("%-6s  %9.0f  %7.3f  %8.3f\n", engines[e].name, total > 0 ? solved / total : 0.0,
+			solved > 0 ? total * 1000 / solved : 0.0, worst * 1000);
+	}
+
+	// The engines should only ever disagree if one of them has a bug
+	int disagreements = 0;
+	for (size_t e = 1; e < numberOfEngines; e++) {
+		for (size_t i = 0; i < results[0].size(); i++) {
+			if (results[e][i] != results[0][i]) {
+				fprintf(stderr, "Puzzle %zu: %s found %d solutions, %s found %d\n", i + 1, engines[0].name, results[0][i],
+					engines[e].name, results[e][i]);
+				disagreements++;
+			}
+		}
+	}
+	return disagreements > 0 ? 1 : 0;
+}
+
+// Puzzles per second on one thread with the digit counting kernels limited to each instruction set the processor has, and
+// how fast each kernel counts the units of the puzzles' starting tables on its own. Counting is a small part of a solve,
+// so the kernels differ far more than the solves do.
+static int benchSimd(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+	RuntimeGeometry g(corpus.boxWidth, corpus.boxHeight);
+	int cells = g.size * g.size;
+	std::vector<DigitMask> tables;
+	for (const std::string& line : corpus.lines) {
+		if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+		for (int cell = 0; cell < cells; cell++) {
+			tables.push_back(sudoku[cell] > 0 ? digitBit(sudoku[cell]) : allDigits(g.size));
+		}
+	}
+	std::vector<DigitCounts> counts(3 * (size_t)g.size);
+
+	SimdLevel supported = supportedSimdLevel();
+	printf("%zu puzzles, %dx%d boxes, %s supported\n", corpus.lines.size() * options.repeat, corpus.boxWidth, corpus.boxHeight,
+		simdLevelName(supported));
+	printf("kernel  puzzles/s  speedup     units/s  speedup\n");
+
+	double scalar = 0, scalarUnits = 0;
+	for (int level = ScalarLevel; level <= supported; level++) {
+		setSimdLevel((SimdLevel)level);
+		size_t solved = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < options.repeat; r++) {
+			for (const std::string& line : corpus.lines) {
+				if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+				Solve(sudoku);
+				solved++;
+			}
+		}
+		double seconds = secondsSince(start);
+		double rate = seconds > 0 ? solved / seconds : 0;
+
+		// Every unit of every table in one call each, as applyRules counts its dirty units
+		size_t units = 0;
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < 100 * options.repeat; r++) {
+			for (size_t table = 0; table < tables.size(); table += cells) {
+				countUnitDigits(&tables[table], g.unit(0), 3 * g.size, g.size, counts.data());
+				units += counts.size();
+			}
+		}
+		double unitSeconds = secondsSince(start);
+		double unitRate = unitSeconds > 0 ? units / unitSeconds : 0;
+
+		if (level == ScalarLevel) {
+			scalar = rate;
+			scalarUnits = unitRate;
+		}
+		printf("%-6s  %9.0f  %7.2f  %10.0f  %7.2f\n", simdLevelName((SimdLevel)level), rate, scalar > 0 ? rate / scalar : 0.0,
+			unitRate, scalarUnits > 0 ? unitRate / scalarUnits : 0.0);
+	}
+	setSimdLevel(supported);
+	return 0;
+}
+
+// Search nodes and puzzles per second on one thread with subsets off and looking for naked and hidden subsets of up to 2, 3
+// and 4 cells
+static int benchSubsets(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+	printf("%zu puzzles, %dx%d boxes\n", corpus.lines.size() * options.repeat, corpus.boxWidth, corpus.boxHeight);
+	printf("subsets  nodes/puzzle  puzzles/s\n");
+
+	for (int subsetSize = 1; subsetSize <= 4; subsetSize++) {
+		SolveStats stats;
+		SolveOptions solveOptions;
+		solveOptions.subsetSize = subsetSize;
+		solveOptions.stats = &stats;
+
+		long long nodes = 0;
+		size_t solved = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < options.repeat; r++) {
+			for (const std::string& line : corpus.lines) {
+				if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+				Solve(sudoku, solveOptions);
+				nodes += stats.nodes;
+				solved++;
+			}
+		}
+		double seconds = secondsSince(start);
+		printf("%7s  %12.1f  %9.0f\n", subsetSize < 2 ? "off" : std::to_string(subsetSize).c_str(),
+			solved > 0 ? (double)nodes / solved : 0.0, seconds > 0 ? solved / seconds : 0.0);
+	}
+	return 0;
+}
+
+// Search nodes and puzzles per second on one thread with each way of picking a guess
+static int benchBranching(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	static const BranchHeuristic heuristics[] = { FewestCandidates, MostConstrainedPeers, FewestPositions };
+	static const char* const names[] = { "fewest", "peers", "positions" };
+
+	Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+	printf("%zu puzzles, %dx%d boxes\n", corpus.lines.size() * options.repeat, corpus.boxWidth, corpus.boxHeight);
+	printf("heuristic  nodes/puzzle  puzzles/s\n");
+
+	for (int h = 0; h < 3; h++) {
+		SolveStats stats;
+		SolveOptions solveOptions;
+		solveOptions.heuristic = heuristics[h];
+		solveOptions.stats = &stats;
+
+		long long nodes = 0;
+		size_t solved = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < options.repeat; r++) {
+			for (const std::string& line : corpus.lines) {
+				if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+				Solve(sudoku, solveOptions);
+				nodes += stats.nodes;
+				solved++;
+			}
+		}
+		double seconds = secondsSince(start);
+		printf("%-9s  %12.1f  %9.0f\n", names[h], solved > 0 ? (double)nodes / solved : 0.0,
+			seconds > 0 ? solved / seconds : 0.0);
+	}
+	return 0;
+}
+
+// Puzzles per second solving normally and grading on every core (or -j), and how many puzzles needed each technique
+static int benchGrading(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	size_t total = corpus.lines.size() * options.repeat;
+	printf("%zu puzzles, %dx%d boxes, %d threads\n", total, corpus.boxWidth, corpus.boxHeight,
+		options.threads > 0 ? options.threads : defaultBatchThreads());
+	printf("mode    puzzles/s\n");
+
+	long long hardest[NumberOfTechniques] = {};
+	long long uses[NumberOfTechniques] = {};
+	for (int grade = 0; grade < 2; grade++) {
+		SolveOptions solveOptions;
+		solveOptions.grade = grade != 0;
+
+		size_t read = 0, solved = 0;
+		auto next = [&](BatchItem& item) {
+			if (read == total) return false;
+			const std::string& line = corpus.lines[read++ % corpus.lines.size()];
+			item.valid = parsePuzzle(line.data(), line.size(), options.encoding, item.shape(corpus.boxWidth, corpus.boxHeight));
+			return true;
+		};
+		auto done = [&](BatchItem& item) {
+			if (!item.valid) return;
+			solved++;
+			if (!grade) return;
+			hardest[item.stats.hardest]++;
+			for (int t = 0; t < NumberOfTechniques; t++) {
+				uses[t] += t == Guessing ? item.stats.nodes : item.stats.uses[t];
+			}
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		solveBatch(options.threads, 0, next, done, solveOptions);
+		double seconds = secondsSince(start);
+		printf("%-6s  %9.0f\n", grade ? "graded" : "plain", seconds > 0 ? solved / seconds : 0.0);
+	}
+
+	printf("\ntechnique          hardest in  uses/puzzle\n");
+	for (int t = 0; t < NumberOfTechniques; t++) {
+		printf("%-17s  %10lld  %11.2f\n", techniqueName((Technique)t), hardest[t], total > 0 ? (double)uses[t] / total : 0.0);
+	}
+	return 0;
+}
+
+// A random transform of the grid: digits relabelled, rows shuffled within bands, bands shuffled, the same for columns and
+// stacks, and for square boxes a coin toss for transposing
+static void randomTransform(int boxWidth, int boxHeight, SplitMix64& random, GridTransform& transform) {
+	int size = boxWidth * boxHeight;
+	transform.transposed = boxWidth == boxHeight && random.below(2) == 1;
+	int groups[64], lines[64];
+	for (int side = 0; side < 2; side++) {
+		// Rows come in boxWidth bands of boxHeight, columns in boxHeight stacks of boxWidth
+		int count = side == 0 ? boxWidth : boxHeight;
+		int width = size / count;
+		int* order = side == 0 ? transform.rows : transform.columns;
+		for (int g = 0; g < count; g++) {
+			groups[g] = g;
+		}
+		for (int g = count - 1; g > 0; g--) {
+			std::swap(groups[g], groups[random.below(g + 1)]);
+		}
+		for (int g = 0; g < count; g++) {
+			for (int i = 0; i < width; i++) {
+				lines[i] = i;
+			}
+			for (int i = width - 1; i > 0; i--) {
+				std::swap(lines[i], lines[random.below(i + 1)]);
+			}
+			for (int i = 0; i < width; i++) {
+				order[g * width + i] = groups[g] * width + lines[i];
+			}
+		}
+	}
+	for (int d = 1; d <= size; d++) {
+		transform.digits[d] = d;
+	}
+	for (int d = size; d > 1; d--) {
+		std::swap(transform.digits[d], transform.digits[1 + random.below(d)]);
+	}
+}
+
+// The corpus once as it is and then -r - 1 more times, each puzzle randomly transformed, solved with and without a
+// solution cache big enough for the whole corpus. Fails if a transformed puzzle has a different canonical form or the
+// cache gives a different answer.
+static int benchCache(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	std::vector<Sudoku> puzzles;
+	std::vector<size_t> original; // index of the untransformed puzzle each one came from
+	Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+	SplitMix64 random(1);
+	for (int r = 0; r < options.repeat; r++) {
+		for (size_t i = 0; i < corpus.lines.size(); i++) {
+			const std::string& line = corpus.lines[i];
+			if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+			original.push_back(r == 0 ? puzzles.size() : original[i]);
+			if (r == 0) {
+				puzzles.push_back(sudoku);
+				continue;
+			}
+			GridTransform transform;
+			randomTransform(corpus.boxWidth, corpus.boxHeight, random, transform);
+			puzzles.emplace_back();
+			applyTransform(sudoku, transform, puzzles.back());
+		}
+	}
+	size_t total = puzzles.size();
+	printf("%zu puzzles, %dx%d boxes, %d threads\n", total, corpus.boxWidth, corpus.boxHeight,
+		options.threads > 0 ? options.threads : defaultBatchThreads());
+
+	// Every copy of a puzzle has to have the same canonical form
+	std::vector<Sudoku> canonical(total);
+	std::vector<bool> found(total);
+	size_t gaveUp = 0, differ = 0;
+	GridTransform transform;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < total; i++) {
+		found[i] = canonicalize(puzzles[i], canonical[i], transform);
+	}
+	double canonicalSeconds = secondsSince(start);
+	for (size_t i = 0; i < total; i++) {
+		if (!found[i]) gaveUp++;
+		else if (found[original[i]] && !std::equal(canonical[i].all().begin(), canonical[i].all().end(), canonical[original[i]].all().begin())) differ++;
+	}
+	printf("canonical form: %.1f us per puzzle, %zu gave up, %zu differ from the untransformed puzzle\n",
+		total > 0 ? canonicalSeconds * 1e6 / total : 0.0, gaveUp, differ);
+
+	printf("mode     puzzles/s\n");
+	std::vector<Sudoku> results[2];
+	std::vector<int> statuses[2];
+	// Each shard of the cache holds its own share, so leave room for the puzzles not hashing evenly
+	SolutionCache cache(corpus.lines.size() * 2);
+	for (int cached = 0; cached < 2; cached++) {
+		SolveOptions solveOptions;
+		if (cached) solveOptions.cache = &cache;
+		results[cached].resize(total);
+		statuses[cached].resize(total);
+
+		size_t read = 0;
+		auto next = [&](BatchItem& item) {
+			if (read == total) return false;
+			item.shape(corpus.boxWidth, corpus.boxHeight) = puzzles[read++];
+			item.valid = true;
+			return true;
+		};
+		auto done = [&](BatchItem& item) {
+			results[cached][item.sequence] = item.sudoku;
+			statuses[cached][item.sequence] = item.numberOfSolutions;
+		};
+
+		start = std::chrono::steady_clock::now();
+		solveBatch(options.threads, 0, next, done, solveOptions);
+		double seconds = secondsSince(start);
+		printf("%-7s  %9.0f\n", cached ? "cached" : "plain", seconds > 0 ? total / seconds : 0.0);
+	}
+
+	size_t wrong = 0;
+	for (size_t i = 0; i < total; i++) {
+		// Puzzles without a unique solution are left as far as the rules got, which can depend on the order they went in
+		if (statuses[0][i] != statuses[1][i]) wrong++;
+		else if (statuses[0][i] == 1 && !std::equal(results[0][i].all().begin(), results[0][i].all().end(), results[1][i].all().begin())) wrong++;
+	}
+	SolutionCacheStats stats = cache.stats();
+	printf("\n%lld solved without a lookup, %lld hits, %lld misses, %lld not canonical, %.1f%% hit rate\n", stats.solvedFirst,
+		stats.hits, stats.misses, stats.skipped, stats.hitRate() * 100);
+	printf("%lld puzzles cached in %.1f KiB, %.0f bytes each\n", stats.entries, stats.bytes / 1024.0,
+		stats.entries > 0 ? (double)stats.bytes / stats.entries : 0.0);
+
+	if (differ > 0 || wrong > 0) {
+		fprintf(stderr, "%zu canonical forms differed and %zu cached answers were wrong\n", differ, wrong);
+		return 1;
+	}
+	return 0;
+}
+
+// Time to read the corpus (-r times over) from a text file and from a packed binary file, against the time to solve it
+// on one thread. Both files are temporary and read back from the page cache, so this is the cost of parsing rather than
+// of the disk.
+static int benchBinary(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	size_t total = corpus.lines.size() * options.repeat;
+	BinaryLayout layout(BinaryPuzzles, corpus.boxWidth, corpus.boxHeight);
+	FILE* textFile = tmpfile();
+	FILE* binaryFile = tmpfile();
+	if (textFile == NULL || binaryFile == NULL) {
+		fprintf(stderr, "Could not make a temporary file\n");
+		return 2;
+	}
+
+	Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+	std::vector<unsigned char> record(layout.recordSize);
+	unsigned char header[BinaryHeaderSize];
+	writeBinaryHeader(layout, header);
+	fwrite(header, 1, sizeof(header), binaryFile);
+	size_t valid = 0;
+	for (size_t i = 0; i < total; i++) {
+		const std::string& line = corpus.lines[i % corpus.lines.size()];
+		fprintf(textFile, "%s\n", line.c_str());
+		if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+		packGrid(sudoku, layout, record.data());
+		fwrite(record.data(), 1, record.size(), binaryFile);
+		valid++;
+	}
+	fflush(textFile);
+	fflush(binaryFile);
+	size_t textBytes = (size_t)ftell(textFile), binaryBytes = (size_t)ftell(binaryFile);
+	rewind(textFile);
+
+	// A sum of every cell read, so both readers can be checked against each other
+	auto checksum = [](const Sudoku& s) {
+		unsigned long long sum = 0;
+		ConstCellSpan cells = s.all();
+		for (int i = 0; i < cells.size; i++) sum += (unsigned long long)(unsigned char)cells[i] * (i + 1);
+		return sum;
+	};
+
+	printf("%zu puzzles, %dx%d boxes, %d bits a cell\n", valid, corpus.boxWidth, corpus.boxHeight, layout.bitsPerCell);
+	printf("format       bytes/puzzle  puzzles/s      MB/s\n");
+
+	auto start = std::chrono::steady_clock::now();
+	LineReader reader(textFile);
+	const char* text;
+	size_t length;
+	bool tooLong;
+	size_t textPuzzles = 0;
+	unsigned long long textSum = 0;
+	while (reader.next(text, length, tooLong)) {
+		if (tooLong || !parsePuzzle(text, length, options.encoding, sudoku)) continue;
+		textSum += checksum(sudoku);
+		textPuzzles++;
+	}
+	double seconds = secondsSince(start);
+	printf("%-11s  %12.1f  %9.0f  %8.1f\n", "text", (double)textBytes / total, seconds > 0 ? textPuzzles / seconds : 0.0,
+		seconds > 0 ? textBytes / seconds / 1e6 : 0.0);
+
+	start = std::chrono::steady_clock::now();
+	BinaryFile binary;
+	const char* error;
+	if (!binary.open(binaryFile, error)) {
+		fprintf(stderr, "Could not map the binary file%s%s\n", error ? ": " : "", error ? error : "");
+		return 2;
+	}
+	size_t binaryPuzzles = 0;
+	unsigned long long binarySum = 0;
+	for (size_t i = 0; i < binary.count(); i++) {
+		if (!unpackGrid(binary.record(i), binary.layout(), sudoku)) continue;
+		binarySum += checksum(sudoku);
+		binaryPuzzles++;
+	}
+	seconds = secondsSince(start);
+	printf("%-11s  %12.1f  %9.0f  %8.1f\n", "binary", (double)binaryBytes / total, seconds > 0 ? binaryPuzzles / seconds : 0.0,
+		seconds > 0 ? binaryBytes / seconds / 1e6 : 0.0);
+	fclose(textFile);
+	fclose(binaryFile);
+
+	// The corpus once over is enough to see how fast a thread solves
+	size_t read = 0, solved = 0;
+	auto next = [&](BatchItem& item) {
+		if (read == corpus.lines.size()) return false;
+		const std::string& line = corpus.lines[read++];
+		item.valid = parsePuzzle(line.data(), line.size(), options.encoding, item.shape(corpus.boxWidth, corpus.boxHeight));
+		return true;
+	};
+	auto done = [&](BatchItem& item) {
+		if (item.valid) solved++;
+	};
+	start = std::chrono::steady_clock::now();
+	solveBatch(1, 0, next, done);
+	seconds = secondsSince(start);
+	printf("%-11s  %12s  %9.0f\n", "solving", "", seconds > 0 ? solved / seconds : 0.0);
+
+	if (textPuzzles != binaryPuzzles || textSum != binarySum) {
+		printf("binary file read back differently: %zu puzzles against %zu from text\n", binaryPuzzles, textPuzzles);
+		return 1;
+	}
+	return 0;
+}
+
+#ifndef _WIN32
+// Throughput and latency of a solve server on the loopback address, sending the corpus (-r times over) down one
+// connection with up to a window of requests outstanding, against solving the same puzzles with solveBatch. Every result
+// is checked against solving the puzzle directly.
+static int benchServer(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	// What each puzzle should come back as
+	std::vector<Sudoku> puzzles, expected;
+	std::vector<int> statuses;
+	for (const std::string& line : corpus.lines) {
+		Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+		if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+		puzzles.push_back(sudoku);
+		statuses.push_back(Solve(sudoku));
+		expected.push_back(sudoku);
+	}
+	size_t total = puzzles.size() * options.repeat;
+	int threads = options.threads > 0 ? options.threads : defaultBatchThreads();
+	printf("%zu puzzles, %dx%d boxes, %d threads\n", total, corpus.boxWidth, corpus.boxHeight, threads);
+
+	size_t read = 0, solved = 0;
+	auto next = [&](BatchItem& item) {
+		if (read == total) return false;
+		item.shape(corpus.boxWidth, corpus.boxHeight) = puzzles[read++ % puzzles.size()];
+		item.valid = true;
+		return true;
+	};
+	auto done = [&](BatchItem&) {
+		solved++;
+	};
+	auto start = std::chrono::steady_clock::now();
+	solveBatch(threads, 0, next, done);
+	double batchSeconds = secondsSince(start);
+
+	ServerOptions serverOptions;
+	serverOptions.threads = threads;
+	SolveServer server(serverOptions);
+	if (!server.listenTcp(0)) {
+		fprintf(stderr, "Could not listen on the loopback address: %s\n", strerror(errno));
+		return 2;
+	}
+	std::thread serving([&] { server.run(); });
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons((uint16_t)server.port());
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+		fprintf(stderr, "Could not connect to the server: %s\n", strerror(errno));
+		server.stop();
+		serving.join();
+		return 2;
+	}
+
+	const size_t window = 1024;
+	std::vector<double> sentAt(total), latencies;
+	latencies.reserve(total);
+	std::vector<unsigned char> out, in;
+	SolveRequest request;
+	SolveResponse response;
+	size_t sent = 0, received = 0, wrong = 0;
+	bool failed = false;
+	start = std::chrono::steady_clock::now();
+	while (received < total && !failed) {
+		// Top the window up, then wait for at least one result
+		out.clear();
+		for (; sent < total && sent - received < window; sent++) {
+			request.id = (uint32_t)sent;
+			request.timeoutMs = 0;
+			request.firstSolution = false;
+			request.sudoku = puzzles[sent % puzzles.size()];
+			appendSolveRequest(request, out);
+			sentAt[sent] = secondsSince(start);
+		}
+		for (size_t at = 0; at < out.size();) {
+			ssize_t n = write(fd, out.data() + at, out.size() - at);
+			if (n <= 0) {
+				failed = true;
+				break;
+			}
+			at += (size_t)n;
+		}
+
+		size_t used = in.size();
+		in.resize(used + 65536);
+		ssize_t n = failed ? -1 : ::read(fd, in.data() + used, 65536);
+		if (n <= 0) {
+			failed = true;
+			break;
+		}
+		in.resize(used + (size_t)n);
+
+		size_t offset = 0;
+		const unsigned char* payload;
+		size_t length;
+		bool tooLong;
+		while (size_t taken = nextMessage(in.data() + offset, in.size() - offset, payload, length, tooLong)) {
+			offset += taken;
+			if (!decodeSolveResponse(payload, length, response) || response.id >= total) {
+				failed = true;
+				break;
+			}
+			latencies.push_back(secondsSince(start) - sentAt[response.id]);
+			size_t index = response.id % puzzles.size();
+			const Sudoku& answer = expected[index];
+			bool same = response.status == statuses[index];
+			if (same && response.status < ServerTimedOut) {
+				for (int cell = 0; cell < answer.size * answer.size; cell++) {
+					if (response.sudoku[cell] != answer[cell]) same = false;
+				}
+			}
+			if (!same) wrong++;
+			received++;
+		}
+		in.erase(in.begin(), in.begin() + offset);
+	}
+	double serverSeconds = secondsSince(start);
+	close(fd);
+	server.stop();
+	serving.join();
+
+	if (failed) {
+		fprintf(stderr, "The connection to the server failed after %zu results\n", received);
+		return 1;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double p) { return latencies.empty() ? 0.0 : latencies[(size_t)(p * (latencies.size() - 1))] * 1000; };
+	ServerMetrics metrics = server.metrics();
+	printf("path        puzzles/s  p50 ms  p99 ms\n");
+	printf("%-10s  %9.0f\n", "batch", batchSeconds > 0 ? solved / batchSeconds : 0.0);
+	printf("%-10s  %9.0f  %6.2f  %6.2f\n", "server", serverSeconds > 0 ? received / serverSeconds : 0.0, percentile(0.5), percentile(0.99));
+	printf("at most %lld queued, %.1f puzzles a batch, %.3f ms mean wait for a worker\n", metrics.maxQueued, metrics.meanBatch,
+		metrics.meanWaitMs);
+	if (wrong > 0) {
+		printf("%zu results differ from solving the puzzle directly\n", wrong);
+		return 1;
+	}
+	return 0;
+}
+#endif
+
+// Heap allocations made by Solve() on one thread with each engine, once every puzzle has been solved once to warm up.
+// Solving should not allocate at all by then, so any allocation is reported as a failure.
+static int benchAllocations(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	static const SolveEngine engines[] = { RuleEngine, DancingLinksEngine };
+	static const char* const names[] = { "rules", "dlx" };
+
+	Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+	printf("%zu puzzles, %dx%d boxes\n", corpus.lines.size() * options.repeat, corpus.boxWidth, corpus.boxHeight);
+	printf("engine  warm-up allocations  allocations/puzzle\n");
+
+	int result = 0;
+	for (int e = 0; e < 2; e++) {
+		SolveOptions solveOptions;
+		solveOptions.engine = engines[e];
+
+		long long warmUp = 0, allocations = 0;
+		size_t solved = 0;
+		for (int r = 0; r <= options.repeat; r++) {
+			for (const std::string& line : corpus.lines) {
+				if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+				long long before = heapAllocations.load();
+				Solve(sudoku, solveOptions);
+				long long made = heapAllocations.load() - before;
+				if (r == 0) {
+					warmUp += made;
+					continue;
+				}
+				allocations += made;
+				solved++;
+			}
+		}
+		printf("%-6s  %19lld  %18.2f\n", names[e], warmUp, solved > 0 ? (double)allocations / solved : 0.0);
+		if (allocations > 0) result = 1;
+	}
+	if (result) fprintf(stderr, "Solving allocated after warming up\n");
+	return result;
+}
+
+// Throughput with limits on the search that are never reached, which still have to be checked, and how closely searches
+// keep to node limits, time limits and cancellation. Fails if a search that gave up at a node limit tried a different
+// number of nodes.
+static int benchLimits(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+	size_t total = corpus.lines.size() * options.repeat;
+	printf("%zu puzzles, %dx%d boxes\n", total, corpus.boxWidth, corpus.boxHeight);
+	printf("limits     puzzles/s\n");
+
+	CancelToken never;
+	for (int limited = 0; limited < 2; limited++) {
+		SolveOptions solveOptions;
+		if (limited) {
+			solveOptions.deadline = std::chrono::steady_clock::now() + std::chrono::hours(24);
+			solveOptions.nodeLimit = LLONG_MAX;
+			solveOptions.cancel = &never;
+		}
+
+		size_t solved = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < options.repeat; r++) {
+			for (const std::string& line : corpus.lines) {
+				if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+				Solve(sudoku, solveOptions);
+				solved++;
+			}
+		}
+		double seconds = secondsSince(start);
+		printf("%-9s  %9.0f\n", limited ? "unreached" : "none", seconds > 0 ? solved / seconds : 0.0);
+	}
+
+	// Enumerating every solution is the longest search there is, so it is the one most likely to reach a limit
+	static const SolveEngine engines[] = { RuleEngine, DancingLinksEngine };
+	static const char* const names[] = { "rules", "dlx" };
+	static const long long nodeLimits[] = { 1, 10, 100, 1000 };
+	int wrong = 0;
+	printf("\nengine  node limit  gave up  wrong count\n");
+	for (int e = 0; e < 2; e++) {
+		for (long long nodeLimit : nodeLimits) {
+			SolveStats stats;
+			SolveOptions solveOptions;
+			solveOptions.engine = engines[e];
+			solveOptions.mode = EnumerateAll;
+			solveOptions.nodeLimit = nodeLimit;
+			solveOptions.stats = &stats;
+
+			long long gaveUp = 0, wrongCount = 0;
+			for (const std::string& line : corpus.lines) {
+				if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+				if (Solve(sudoku, solveOptions) != SolveAborted) continue;
+				gaveUp++;
+				if (stats.nodes != nodeLimit || stats.aborted != NodeLimitReached) wrongCount++;
+			}
+			printf("%-6s  %10lld  %7lld  %11lld\n", names[e], nodeLimit, gaveUp, wrongCount);
+			wrong += (int)wrongCount;
+		}
+	}
+
+	// How long after its deadline, or after being cancelled from another thread, a search takes to return
+	printf("\nlimit            gave up  mean ms late  worst ms late\n");
+	for (int cancelled = 0; cancelled < 2; cancelled++) {
+		for (int ms = 1; ms <= 10; ms *= 10) {
+			CancelToken token;
+			SolveStats stats;
+			SolveOptions solveOptions;
+			solveOptions.mode = EnumerateAll;
+			solveOptions.stats = &stats;
+			if (cancelled) solveOptions.cancel = &token;
+			else solveOptions.timeLimit = std::chrono::milliseconds(ms);
+
+			long long gaveUp = 0;
+			double late = 0, worst = 0;
+			for (const std::string& line : corpus.lines) {
+				if (!parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) continue;
+				// Lateness is counted from when the token was actually cancelled, however late the thread woke up
+				token.reset();
+				auto due = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+				std::thread canceller;
+				if (cancelled) {
+					canceller = std::thread([&]() {
+						std::this_thread::sleep_until(due);
+						due = std::chrono::steady_clock::now();
+						token.cancel();
+					});
+				}
+				int numberOfSolutions = Solve(sudoku, solveOptions);
+				auto end = std::chrono::steady_clock::now();
+				if (canceller.joinable()) canceller.join();
+				double seconds = std::chrono::duration<double>(end - due).count();
+				if (numberOfSolutions != SolveAborted) continue;
+				gaveUp++;
+				late += seconds;
+				if (seconds > worst) worst = seconds;
+			}
+			printf("%-6s %3d ms  %7lld  %12.3f  %13.3f\n", cancelled ? "cancel" : "time", ms, gaveUp,
+				gaveUp > 0 ? late * 1000 / gaveUp : 0.0, worst * 1000);
+		}
+	}
+
+	if (wrong > 0) fprintf(stderr, "Searches that gave up at a node limit tried a different number of nodes\n");
+	return wrong > 0 ? 1 : 0;
+}
+
+// Puzzles per second through a SolveExecutor, waiting on futures and with completion callbacks, against solveBatch on
+// the same number of threads. Fails if any result differs from solving the puzzle directly.
+static int benchAsync(const BenchOptions& options) {
+	Corpus corpus;
+	if (!loadCorpus(options, corpus)) return 2;
+
+	std::vector<Sudoku> puzzles;
+	for (const std::string& line : corpus.lines) {
+		Sudoku sudoku(corpus.boxWidth, corpus.boxHeight);
+		if (parsePuzzle(line.data(), line.size(), options.encoding, sudoku)) puzzles.push_back(sudoku);
+	}
+	std::vector<int> expected;
+	std::vector<Sudoku> solved = puzzles;
+	for (Sudoku& sudoku : solved) {
+		expected.push_back(Solve(sudoku));
+	}
+
+	int threads = options.threads > 0 ? options.threads : defaultBatchThreads();
+	size_t total = puzzles.size() * options.repeat;
+	SolveExecutor executor(threads);
+	printf("%zu puzzles, %dx%d boxes, %d threads, at most %zu in flight\n", total, corpus.boxWidth, corpus.boxHeight,
+		threads, executor.maxInFlight());
+	printf("interface  puzzles/s\n");
+
+	auto check = [&](size_t i, const SolveResult& result) {
+		const Sudoku& answer = solved[i % solved.size()];
+		if (result.status != expected[i % expected.size()]) return false;
+		for (int cell = 0; cell < answer.size * answer.size; cell++) {
+			if (result.sudoku[cell] != answer[cell]) return false;
+		}
+		return true;
+	};
+
+	// solveBatch for comparison
+	size_t read = 0;
+	auto next = [&](BatchItem& item) {
+		if (read == total) return false;
+		item.shape(corpus.boxWidth, corpus.boxHeight) = puzzles[read++ % puzzles.size()];
+		item.valid = true;
+		return true;
+	};
+	auto start = std::chrono::steady_clock::now();
+	solveBatch(threads, 0, next, [](BatchItem&) {});
+	double seconds = secondsSince(start);
+	printf("%-9s  %9.0f\n", "batch", seconds > 0 ? total / seconds : 0.0);
+
+	// Futures, waiting on the oldest once as many puzzles are in flight as the executor allows
+	long long wrong = 0;
+	std::deque<std::future<SolveResult>> pending;
+	size_t checked = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < total; i++) {
+		if (pending.size() == executor.maxInFlight()) {
+			if (!check(checked++, pending.front().get())) wrong++;
+			pending.pop_front();
+		}
+		pending.push_back(executor.submit(puzzles[i % puzzles.size()]));
+	}
+	for (; !pending.empty(); pending.pop_front()) {
+		if (!check(checked++, pending.front().get())) wrong++;
+	}
+	seconds = secondsSince(start);
+	printf("%-9s  %9.0f\n", "futures", seconds > 0 ? total / seconds : 0.0);
+
+	// Completions, which submit blocks for once the executor is full
+	std::atomic<long long> callbackWrong(0);
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < total; i++) {
+		executor.submit(puzzles[i % puzzles.size()], SolveOptions(), [&, i](SolveResult& result) {
+			if (!check(i, result)) callbackWrong++;
+		});
+	}
+	executor.wait();
+	seconds = secondsSince(start);
+	printf("%-9s  %9.0f\n", "callbacks", seconds > 0 ? total / seconds : 0.0);
+
+	wrong += callbackWrong;
+	if (wrong > 0) fprintf(stderr, "%lld results differ from solving directly\n", wrong);
+	return wrong > 0 ? 1 : 0;
+}
+
+// Time and memory to solve puzzles of every box shape from 2x2 to 8x8, square and a row or column longer, made by
+// blanking cells of random complete grids. Memory is what the solving thread holds once it has solved the puzzles of a
+// shape, its arena and lookup tables, and the most it held at once while solving them.
+static int benchScaling(const BenchOptions& options) {
+	static const int shapes[][2] = {
+		{ 2, 2 }, { 3, 2 }, { 3, 3 }, { 4, 3 }, { 4, 4 }, { 5, 4 }, { 5, 5 }, { 6, 5 }, { 6, 6 }, { 7, 6 }, { 7, 7 }, { 8, 7 }, { 8, 8 }
+	};
+	// Share of the cells left as clues. At half of them the grids from 25x25 up mostly hit the time limit, searching far
+	// longer than is worth waiting for.
+	const double clueShare = 0.7;
+	const int puzzlesPerShape = 4 * options.repeat;
+	const std::chrono::seconds timeLimit(10);
+
+	printf("%d puzzles a shape, %.0f%% of the cells given, giving up after %lld s\n", puzzlesPerShape, clueShare * 100,
+		(long long)timeLimit.count());
+	printf("grid   boxes  mean ms   worst ms  nodes/puzzle  gave up  held KiB  peak KiB\n");
+
+	SplitMix64 random(1);
+	for (const int* shape : shapes) {
+		int boxWidth = shape[0], boxHeight = shape[1], size = boxWidth * boxHeight;
+
+		// Each row of the pattern is the one above shifted along by a box, or by one more at the start of a band
+		Sudoku pattern(boxWidth, boxHeight);
+		for (int x = 0; x < size; x++) {
+			for (int y = 0; y < size; y++) {
+				pattern.at(x, y) = (CellValue)(((y % boxHeight) * boxWidth + y / boxHeight + x) % size + 1);
+			}
+		}
+		std::vector<Sudoku> puzzles(puzzlesPerShape);
+		for (Sudoku& puzzle : puzzles) {
+			GridTransform transform;
+			randomTransform(boxWidth, boxHeight, random, transform);
+			applyTransform(pattern, transform, puzzle);
+			for (int cell = 0; cell < size * size; cell++) {
+				if (random.next() % 1000 >= clueShare * 1000) puzzle[cell] = -1;
+			}
+		}
+
+		// A thread of its own starts with no arena, so everything it holds at the end is for this shape
+		double total = 0, worst = 0;
+		long long nodes = 0, gaveUp = 0, held = 0, peak = 0;
+		std::thread solver([&]() {
+			long long before = heapBytes.load();
+			heapPeak.store(before);
+			SolveStats stats;
+			SolveOptions solveOptions;
+			solveOptions.timeLimit = timeLimit;
+			solveOptions.stats = &stats;
+			for (Sudoku& puzzle : puzzles) {
+				auto start = std::chrono::steady_clock::now();
+				if (Solve(puzzle, solveOptions) == SolveAborted) gaveUp++;
+				double seconds = secondsSince(start);
+				total += seconds;
+				if (seconds > worst) worst = seconds;
+				nodes += stats.nodes;
+			}
+			held = heapBytes.load() - before;
+			peak = heapPeak.load() - before;
+		});
+		solver.join();
+
+		char grid[16], boxes[16];
+		snprintf(grid, sizeof(grid), "%dx%d", size, size);
+		snprintf(boxes, sizeof(boxes), "%dx%d", boxWidth, boxHeight);
+		printf("%-5s  %-5s  %7.3f  %9.3f  %12.1f  %7lld  %8.1f  %8.1f\n", grid, boxes, total * 1000 / puzzlesPerShape,
+			worst * 1000, (double)nodes / puzzlesPerShape, gaveUp, held / 1024.0, peak / 1024.0);
+		fflush(stdout);
+	}
+	return 0;
+}
+
+struct Benchmark {
+	const char* name;
+	const char* description;
+	int (*run)(const BenchOptions& options);
+	bool noFile; // makes its own puzzles rather than reading a file
+};
+
+static const Benchmark benchmarks[] = {
+	{ "threads", "batch throughput from 1 to N threads", benchThreads, false },
+	{ "parallel", "single puzzle latency searching with 1 to N threads", benchParallel, false },
+	{ "engines", "single thread throughput of the rule based and dancing links engines", benchEngines, false },
+	{ "simd", "single thread throughput with the scalar, SSE2 and AVX2 digit counting kernels", benchSimd, false },
+	{ "subsets", "search nodes and throughput with naked and hidden subsets of up to 2, 3 and 4 cells", benchSubsets, false },
+	{ "branching", "search nodes and throughput with each way of picking a guess", benchBranching, false },
+	{ "grading", "batch throughput solving normally and grading, and the hardest technique each puzzle needed", benchGrading, false },
+	{ "cache", "throughput with and without a solution cache, solving -r randomly transformed copies of each puzzle", benchCache, false },
+	{ "async", "throughput of the asynchronous executor with futures and with callbacks, against batch solving", benchAsync, false },
+	{ "binary", "reading -r copies of the puzzles from text and from a packed binary file, against solving them", benchBinary, false },
+#ifndef _WIN32
+	{ "server", "throughput and latency of a solve server over loopback TCP with up to 1024 requests outstanding", benchServer, false },
+#endif
+	{ "allocations", "heap allocations per solve after warming up, failing if there are any", benchAllocations, false },
+	{ "modes", "single thread throughput finding any, a unique or up to N solutions", benchModes, false },
+	{ "scaling", "time and memory per puzzle for every box shape from 2x2 to 8x8, on puzzles it makes itself", benchScaling, true },
+	{ "limits", "cost of checking time and node limits, and how closely searches keep to them", benchLimits, false },
+};
+
+static void printUsage(const char* program) {
+	fprintf(stderr, "Usage: %s <benchmark> [options] file\n\nBenchmarks (scaling takes no file):\n", program);
+	for (const Benchmark& benchmark : benchmarks) {
+		fprintf(stderr, "  %-11s %s\n", benchmark.name, benchmark.description);
+	}
+	fprintf(stderr,
+		"\nOptions:\n"
+		"  -b, --box WxH         box width and height (default: square boxes worked out from the first puzzle)\n"
+		"  -e, --encoding NAME   digits, hex or alpha, as for sudoku-cli\n"
+		"  -j, --threads N       number of threads (default: one per core)\n"
+		"  -r, --repeat N        solve the file N times over\n");
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	const Benchmark* benchmark = NULL;
+	for (const Benchmark& b : benchmarks) {
+		if (strcmp(argv[1], b.name) == 0) benchmark = &b;
+	}
+	if (benchmark == NULL) {
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	BenchOptions options;
+	for (int i = 2; i < argc; i++) {
+		const char* arg = argv[i];
+		if ((strcmp(arg, "-b") == 0 || strcmp(arg, "--box") == 0) && i + 1 < argc) {
+			if (sscanf(argv[++i], "%dx%d", &options.boxWidth, &options.boxHeight) != 2 || options.boxWidth <= 0 || options.boxHeight <= 0) {
+				fprintf(stderr, "Invalid box size '%s', expected WxH\n", argv[i]);
+				return 2;
+			}
+		}
+		else if ((strcmp(arg, "-e") == 0 || strcmp(arg, "--encoding") == 0) && i + 1 < argc) {
+			if (!parseEncoding(argv[++i], options.encoding)) {
+				fprintf(stderr, "Unknown encoding '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if ((strcmp(arg, "-j") == 0 || strcmp(arg, "--threads") == 0) && i + 1 < argc) {
+			options.threads = atoi(argv[++i]);
+		}
+		else if ((strcmp(arg, "-r") == 0 || strcmp(arg, "--repeat") == 0) && i + 1 < argc) {
+			options.repeat = atoi(argv[++i]);
+			if (options.repeat < 1) options.repeat = 1;
+		}
+		else if (arg[0] == '-') {
+			printUsage(argv[0]);
+			return 2;
+		}
+		else {
+			options.path = arg;
+		}
+	}
+	if (options.path == NULL && !benchmark->noFile) {
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	return benchmark->run(options);
+}
@@ -0,0 +1,431 @@
+// Sudoku CLI.cpp : Solves puzzles read one per line from a file or standard input and writes each result to standard output.
+// Packed binary files (see PuzzleBinary.h) can be read and written instead, and converted to and from text.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "BatchSolver.h"
+#include "PuzzleBinary.h"
+#include "PuzzleText.h"
+#include "SolutionCache.h"
+#include "Solver.h"
+
+static void printUsage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options] [file]\n"
+		"\n"
+		"Solves one puzzle per line from file, or standard input if no file is given, and writes\n"
+		"\"<status> <grid>\" for each to standard output. Status is the number of solutions found:\n"
+		"0 (no solution), 1 (the grid is the solution) or 2 (more than one solution). Lines that\n"
+		"are not a valid puzzle are written as \"E\" and reported on standard error.\n"
+		"With -n the status is the number of solutions up to N, with -1 it is 0 or 1 and the grid\n"
+		"is the first solution found.\n"
+		"With --timeout or --max-nodes, a puzzle the search gives up on is written with status A and\n"
+		"the first solution it found, or else what could be worked out without guessing.\n"
+		"With -g, \"<status> <technique> <counts> <grid>\" is written instead, where technique is\n"
+		"the hardest needed (naked-single, hidden-single, locked-candidates, naked-subset,\n"
+		"hidden-subset or guess) and counts lists how often each of those was used, separated\n"
+		"by commas in the same order. The count for guess is the number of guesses made.\n"
+		"A binary file of puzzles (see -f) is recognised by its header and read where it is mapped\n"
+		"into memory, so it has to be a file (or redirected from one) rather than a pipe.\n"
+		"With -f binary the results are written to a binary file of one status byte and the\n"
+		"packed grid for each puzzle. --convert writes the puzzles read, or the results read from\n"
+		"a binary results file, in the -f format without solving anything.\n"
+		"\n"
+		"Options:\n"
+		"  -b, --box WxH         box width and height (default: square boxes worked out from each line's length)\n"
+		"  -e, --encoding NAME   digits (1-9 then A-Z), hex (0-F for 1-16) or alpha (A-Y for 1-25), default digits\n"
+		"  -f, --format NAME     text (default) or binary, the format of what is written\n"
+		"      --convert         convert the input to the -f format rather than solving it\n"
+		"  -j, --threads N       number of solver threads (default: one per core), results stay in input order\n"
+		"      --engine NAME     rules (default) or dlx for exact cover with dancing links\n"
+		"      --branch NAME     what to guess: fewest (a cell with the fewest digits), peers (of those the cell\n"
+		"                        with the most unsolved peers, default) or positions (also a digit's cells in a unit)\n"
+		"      --subsets N       look for naked and hidden subsets of up to N cells, 0 turns them off (default 2)\n"
+		"      --cache N         keep the solutions of up to N puzzles and answer the same puzzle relabelled,\n"
+		"                        reordered or transposed from them, with -t also report the hit rate\n"
+		"  -g, --grade           grade each puzzle by the techniques needed to solve it, with -t also\n"
+		"                        report how many puzzles needed each technique\n"
+		"  -1, --first           stop at the first solution without checking that it is the only one\n"
+		"  -n, --count N         count solutions, stopping at N\n"
+		"  -p, --parallel N      search each puzzle with N threads, one puzzle at a time. For single hard puzzles.\n"
+		"      --split-depth N   with -p, guesses this deep are shared out between the threads (default 3)\n"
+		"      --timeout MS      give up on a puzzle after MS milliseconds\n"
+		"      --max-nodes N     give up on a puzzle after N guesses\n"
+		"  -s, --status-only     only write the status of each puzzle\n"
+		"  -t, --timing          report the number of puzzles and puzzles per second on standard error\n"
+		"  -h, --help            show this message\n",
+		program);
+}
+
+static bool parseBox(const char* text, int& boxWidth, int& boxHeight) {
+	char* end;
+	boxWidth = (int)strtol(text, &end, 10);
+	if (*end != 'x' && *end != 'X') return false;
+	boxHeight = (int)strtol(end + 1, &end, 10);
+	return *end == '\0' && boxWidth > 0 && boxHeight > 0 && boxWidth * boxHeight <= MaxSudokuSize;
+}
+
+int main(int argc, char* argv[]) {
+	int boxWidth = 0, boxHeight = 0;
+	CellEncoding encoding = DigitEncoding;
+	bool statusOnly = false;
+	bool timing = false;
+	bool binaryOutput = false;
+	bool convert = false;
+	int threads = 0;
+	long long graded[NumberOfTechniques] = {};
+	long long cacheSize = 0;
+	SolveOptions options;
+	const char* path = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if ((strcmp(arg, "-b") == 0 || strcmp(arg, "--box") == 0) && i + 1 < argc) {
+			if (!parseBox(argv[++i], boxWidth, boxHeight)) {
+				fprintf(stderr, "Invalid box size '%s', expected WxH\n", argv[i]);
+				return 2;
+			}
+		}
+		else if ((strcmp(arg, "-e") == 0 || strcmp(arg, "--encoding") == 0) && i + 1 < argc) {
+			if (!parseEncoding(argv[++i], encoding)) {
+				fprintf(stderr, "Unknown encoding '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if ((strcmp(arg, "-f") == 0 || strcmp(arg, "--format") == 0) && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (strcmp(name, "text") == 0) binaryOutput = false;
+			else if (strcmp(name, "binary") == 0) binaryOutput = true;
+			else {
+				fprintf(stderr, "Unknown format '%s'\n", name);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "--convert") == 0) {
+			convert = true;
+		}
+		else if ((strcmp(arg, "-j") == 0 || strcmp(arg, "--threads") == 0) && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+			if (threads < 1) {
+				fprintf(stderr, "Invalid number of threads '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "--engine") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (strcmp(name, "rules") == 0) options.engine = RuleEngine;
+			else if (strcmp(name, "dlx") == 0) options.engine = DancingLinksEngine;
+			else {
+				fprintf(stderr, "Unknown engine '%s'\n", name);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "--branch") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (strcmp(name, "fewest") == 0) options.heuristic = FewestCandidates;
+			else if (strcmp(name, "peers") == 0) options.heuristic = MostConstrainedPeers;
+			else if (strcmp(name, "positions") == 0) options.heuristic = FewestPositions;
+			else {
+				fprintf(stderr, "Unknown branching heuristic '%s'\n", name);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "--subsets") == 0 && i + 1 < argc) {
+			options.subsetSize = atoi(argv[++i]);
+		}
+		else if (strcmp(arg, "--cache") == 0 && i + 1 < argc) {
+			cacheSize = atoll(argv[++i]);
+			if (cacheSize < 1) {
+				fprintf(stderr, "Invalid cache size '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "-g") == 0 || strcmp(arg, "--grade") == 0) {
+			options.grade = true;
+		}
+		else if (strcmp(arg, "-1") == 0 || strcmp(arg, "--first") == 0) {
+			options.mode = FindAny;
+		}
+		else if ((strcmp(arg, "-n") == 0 || strcmp(arg, "--count") == 0) && i + 1 < argc) {
+			options.mode = CountUpTo;
+			options.limit = atoi(argv[++i]);
+			if (options.limit < 1) {
+				fprintf(stderr, "Invalid number of solutions '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if ((strcmp(arg, "-p") == 0 || strcmp(arg, "--parallel") == 0) && i + 1 < argc) {
+			options.threads = atoi(argv[++i]);
+			if (options.threads < 1) {
+				fprintf(stderr, "Invalid number of threads '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "--split-depth") == 0 && i + 1 < argc) {
+			options.splitDepth = atoi(argv[++i]);
+		}
+		else if (strcmp(arg, "--timeout") == 0 && i + 1 < argc) {
+			long long ms = atoll(argv[++i]);
+			if (ms < 1) {
+				fprintf(stderr, "Invalid timeout '%s'\n", argv[i]);
+				return 2;
+			}
+			options.timeLimit = std::chrono::milliseconds(ms);
+		}
+		else if (strcmp(arg, "--max-nodes") == 0 && i + 1 < argc) {
+			options.nodeLimit = atoll(argv[++i]);
+			if (options.nodeLimit < 1) {
+				fprintf(stderr, "Invalid number of nodes '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--status-only") == 0) {
+			statusOnly = true;
+		}
+		else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--timing") == 0) {
+			timing = true;
+		}
+		else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+			printUsage(argv[0]);
+			return 0;
+		}
+		else if (arg[0] == '-' && arg[1] != '\0') {
+			printUsage(argv[0]);
+			return 2;
+		}
+		else {
+			path = arg;
+		}
+	}
+
+	if (options.grade && options.engine != RuleEngine) {
+		fprintf(stderr, "Grading needs the rules engine\n");
+		return 2;
+	}
+	if (convert && options.grade) {
+		fprintf(stderr, "-g can't be used with --convert, which doesn't solve anything\n");
+		return 2;
+	}
+	if (binaryOutput && (options.grade || statusOnly)) {
+		fprintf(stderr, "-g and -s only apply to text output\n");
+		return 2;
+	}
+
+	std::unique_ptr<SolutionCache> cache;
+	if (cacheSize > 0) {
+		cache.reset(new SolutionCache((size_t)cacheSize));
+		options.cache = cache.get();
+	}
+
+	FILE* input = stdin;
+	if (path != NULL && strcmp(path, "-") != 0) {
+		input = fopen(path, "rb");
+		if (input == NULL) {
+			fprintf(stderr, "Could not open '%s'\n", path);
+			return 2;
+		}
+	}
+
+	// A binary file is read where it is mapped. Anything that can't be mapped, such as a pipe, is read as text.
+	BinaryFile binaryInput;
+	const char* error;
+	bool binary = binaryInput.open(input, error);
+	if (!binary && error != NULL) {
+		fprintf(stderr, "'%s' %s\n", input == stdin ? "standard input" : path, error);
+		return 2;
+	}
+	bool resultsInput = binary && binaryInput.layout().kind == BinaryResults;
+	if (resultsInput && !convert) {
+		fprintf(stderr, "'%s' holds results rather than puzzles, it can only be converted\n", input == stdin ? "standard input" : path);
+		return 2;
+	}
+	const char* unit = binary ? "Record" : "Line";
+
+	static char outputBuffer[1 << 20];
+	setvbuf(stdout, outputBuffer, _IOFBF, sizeof(outputBuffer));
+#ifdef _WIN32
+	if (binaryOutput) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	LineReader reader(input);
+	size_t nextRecord = 0;
+	std::vector<char> line;
+	long long puzzles = 0, invalid = 0, aborted = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	auto next = [&](BatchItem& item) {
+		if (binary) {
+			if (nextRecord == binaryInput.count()) return false;
+			const BinaryLayout& layout = binaryInput.layout();
+			const unsigned char* record = binaryInput.record(nextRecord++);
+			item.tag = nextRecord;
+			Sudoku& s = item.shape(layout.boxWidth, layout.boxHeight);
+			if (resultsInput) {
+				item.valid = unpackResult(record, layout, s, item.numberOfSolutions) && item.numberOfSolutions != BinaryInvalid;
+			}
+			else {
+				item.valid = unpackGrid(record, layout, s);
+			}
+			return true;
+		}
+
+		const char* text;
+		size_t length;
+		bool tooLong;
+		do {
+			if (!reader.next(text, length, tooLong)) return false;
+		} while (length == 0 || text[0] == '#');
+
+		item.tag = reader.lineNumber();
+		item.valid = false;
+		if (tooLong) return true;
+
+		int bW = boxWidth, bH = boxHeight;
+		if (bW == 0) {
+			// Work out the size from the number of cells on the line, assuming square boxes
+			size_t cells = length;
+			while (cells > 0 && (text[cells - 1] == ' ' || text[cells - 1] == '\t' || text[cells - 1] == '\r')) cells--;
+			int size = (int)std::lround(std::sqrt((double)cells));
+			int box = (int)std::lround(std::sqrt((double)size));
+			if (box <= 0 || box * box != size || (size_t)size * size != cells || size > MaxSudokuSize) return true;
+			bW = box;
+			bH = box;
+		}
+		item.valid = parsePuzzle(text, length, encoding, item.shape(bW, bH));
+		return true;
+	};
+
+	// Binary output holds one box shape, taken from -b, a binary input or else the first valid puzzle. Results for lines
+	// that weren't valid puzzles before then are held back until the header can be written.
+	BinaryKind outputKind = convert && !resultsInput ? BinaryPuzzles : BinaryResults;
+	BinaryLayout outputLayout(outputKind, 3, 3);
+	bool headerWritten = false;
+	long long heldBack = 0;
+	std::vector<unsigned char> record;
+
+	auto writeInvalidRecord = [&]() {
+		memset(record.data(), 0, record.size());
+		record[0] = (unsigned char)BinaryInvalid;
+		fwrite(record.data(), 1, record.size(), stdout);
+	};
+
+	auto writeHeader = [&](int bW, int bH) {
+		outputLayout = BinaryLayout(outputKind, bW, bH);
+		unsigned char header[BinaryHeaderSize];
+		writeBinaryHeader(outputLayout, header);
+		fwrite(header, 1, sizeof(header), stdout);
+		record.resize(outputLayout.recordSize);
+		headerWritten = true;
+		for (; heldBack > 0; heldBack--) writeInvalidRecord();
+	};
+	if (binaryOutput && binary) writeHeader(binaryInput.layout().boxWidth, binaryInput.layout().boxHeight);
+	else if (binaryOutput && boxWidth > 0) writeHeader(boxWidth, boxHeight);
+
+	auto done = [&](BatchItem& item) {
+		if (item.valid && binaryOutput && headerWritten &&
+			(item.sudoku.boxWidth != outputLayout.boxWidth || item.sudoku.boxHeight != outputLayout.boxHeight)) {
+			fprintf(stderr, "%s %llu has a different box shape from the first puzzle\n", unit, (unsigned long long)item.tag);
+			item.valid = false;
+		}
+		else if (item.valid && !binaryOutput && ((convert && !resultsInput) || !statusOnly) &&
+			item.sudoku.size > largestDigit(encoding)) {
+			// Binary input can hold sudokus too large to write back as text
+			fprintf(stderr, "%s %llu has more digits than the encoding can write\n", unit, (unsigned long long)item.tag);
+			item.valid = false;
+		}
+		else if (!item.valid) {
+			fprintf(stderr, "%s %llu is not a valid puzzle\n", unit, (unsigned long long)item.tag);
+		}
+
+		if (!item.valid) {
+			invalid++;
+			// A binary puzzle file only holds puzzles, so there is nothing to write
+			if (!binaryOutput) fputs("E\n", stdout);
+			else if (outputKind == BinaryResults && headerWritten) writeInvalidRecord();
+			else if (outputKind == BinaryResults) heldBack++;
+			return;
+		}
+		puzzles++;
+		if (item.numberOfSolutions == SolveAborted) aborted++;
+
+		if (binaryOutput) {
+			if (!headerWritten) writeHeader(item.sudoku.boxWidth, item.sudoku.boxHeight);
+			if (outputKind == BinaryPuzzles) packGrid(item.sudoku, outputLayout, record.data());
+			else packResult(item.sudoku, item.numberOfSolutions, outputLayout, record.data());
+			fwrite(record.data(), 1, record.size(), stdout);
+			return;
+		}
+
+		size_t cells = (size_t)item.sudoku.size * item.sudoku.size;
+		if (line.size() < cells + 256) line.resize(cells + 256);
+		if (convert && !resultsInput) {
+			size_t n = formatPuzzle(item.sudoku, encoding, &line[0]);
+			line[n++] = '\n';
+			fwrite(line.data(), 1, n, stdout);
+			return;
+		}
+
+		size_t n = 1;
+		if (item.numberOfSolutions == SolveAborted) line[0] = 'A';
+		else n = (size_t)snprintf(&line[0], 12, "%d", item.numberOfSolutions);
+		if (options.grade) {
+			const SolveStats& stats = item.stats;
+			graded[stats.hardest]++;
+			n += (size_t)snprintf(&line[n], 32, " %s ", techniqueName(stats.hardest));
+			for (int t = 0; t < NumberOfTechniques; t++) {
+				long long count = t == Guessing ? stats.nodes : stats.uses[t];
+				n += (size_t)snprintf(&line[n], 24, t == 0 ? "%lld" : ",%lld", count);
+			}
+		}
+		if (!statusOnly) {
+			line[n++] = ' ';
+			n += formatPuzzle(item.sudoku, encoding, &line[n]);
+		}
+		line[n++] = '\n';
+		fwrite(line.data(), 1, n, stdout);
+	};
+
+	if (convert) {
+		BatchItem item;
+		while (next(item)) done(item);
+	}
+	else {
+		// Searching inside each puzzle already uses the threads, so the puzzles themselves are taken one at a time
+		if (options.threads > 1) threads = 1;
+		solveBatch(threads, 0, next, done, options);
+	}
+	// Nothing showed the box shape, so the file is for the usual 9x9
+	if (binaryOutput && !headerWritten) writeHeader(3, 3);
+	fflush(stdout);
+
+	if (timing) {
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stderr, "%lld puzzles %sin %.3f s (%.0f puzzles/s)\n", puzzles, convert ? "converted " : "", seconds, seconds > 0 ? puzzles / seconds : 0.0);
+		if (aborted > 0) fprintf(stderr, "%lld puzzles given up on\n", aborted);
+		if (cache) {
+			SolutionCacheStats stats = cache->stats();
+			fprintf(stderr, "cache: %lld solved without a lookup, %lld hits, %lld misses, %lld not canonical (%.1f%% hit rate), %lld puzzles in %.1f KiB\n",
+				stats.solvedFirst, stats.hits, stats.misses, stats.skipped, stats.hitRate() * 100, stats.entries, stats.bytes / 1024.0);
+		}
+		if (options.grade) {
+			for (int t = 0; t < NumberOfTechniques; t++) {
+				fprintf(stderr, "%-18s %lld\n", techniqueName((Technique)t), graded[t]);
+			}
+		}
+	}
+
+	if (input != stdin) fclose(input);
+	return invalid > 0 ? 1 : 0;
+}
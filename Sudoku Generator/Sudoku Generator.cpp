@@ -0,0 +1,150 @@
+// Sudoku Generator.cpp : Makes puzzles with a unique solution and writes them one per line to standard output.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "Generator.h"
+#include "PuzzleText.h"
+
+static void printUsage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options] count\n"
+		"\n"
+		"Makes count puzzles with exactly one solution and writes them one per line to standard\n"
+		"output, in the format sudoku-cli reads. The same seed always gives the same puzzles in the\n"
+		"same order, whatever the number of threads.\n"
+		"\n"
+		"Options:\n"
+		"  -b, --box WxH         box width and height (default 3x3)\n"
+		"  -e, --encoding NAME   digits, hex or alpha, as for sudoku-cli\n"
+		"  -c, --clues N         stop taking clues out once N are left (default: as few as possible)\n"
+		"  -a, --attempts N      complete grids tried per puzzle to get down to --clues (default 1)\n"
+		"      --symmetry NAME   none, rotational (default) or mirror pattern of clues\n"
+		"      --seed N          seed for the random numbers (default 1)\n"
+		"      --max-nodes N     give up proving a puzzle unique after N guesses and keep the clue\n"
+		"                        being tried (default 200, 0 for no limit)\n"
+		"  -j, --threads N       number of threads (default: one per core)\n"
+		"  -t, --timing          report the number of puzzles, puzzles per second and average clues on\n"
+		"                        standard error\n"
+		"  -h, --help            show this message\n",
+		program);
+}
+
+static bool parseBox(const char* text, int& boxWidth, int& boxHeight) {
+	char* end;
+	boxWidth = (int)strtol(text, &end, 10);
+	if (*end != 'x' && *end != 'X') return false;
+	boxHeight = (int)strtol(end + 1, &end, 10);
+	return *end == '\0' && boxWidth > 0 && boxHeight > 0 && boxWidth * boxHeight <= MaxSudokuSize;
+}
+
+int main(int argc, char* argv[]) {
+	GeneratorOptions options;
+	CellEncoding encoding = DigitEncoding;
+	int threads = 0;
+	bool timing = false;
+	long long count = -1;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if ((strcmp(arg, "-b") == 0 || strcmp(arg, "--box") == 0) && i + 1 < argc) {
+			if (!parseBox(argv[++i], options.boxWidth, options.boxHeight)) {
+				fprintf(stderr, "Invalid box size '%s', expected WxH\n", argv[i]);
+				return 2;
+			}
+		}
+		else if ((strcmp(arg, "-e") == 0 || strcmp(arg, "--encoding") == 0) && i + 1 < argc) {
+			if (!parseEncoding(argv[++i], encoding)) {
+				fprintf(stderr, "Unknown encoding '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if ((strcmp(arg, "-c") == 0 || strcmp(arg, "--clues") == 0) && i + 1 < argc) {
+			options.targetClues = atoi(argv[++i]);
+		}
+		else if ((strcmp(arg, "-a") == 0 || strcmp(arg, "--attempts") == 0) && i + 1 < argc) {
+			options.attempts = atoi(argv[++i]);
+			if (options.attempts < 1) {
+				fprintf(stderr, "Invalid number of attempts '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "--symmetry") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (strcmp(name, "none") == 0) options.symmetry = NoSymmetry;
+			else if (strcmp(name, "rotational") == 0) options.symmetry = RotationalSymmetry;
+			else if (strcmp(name, "mirror") == 0) options.symmetry = MirrorSymmetry;
+			else {
+				fprintf(stderr, "Unknown symmetry '%s'\n", name);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "--seed") == 0 && i + 1 < argc) {
+			options.seed = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(arg, "--max-nodes") == 0 && i + 1 < argc) {
+			options.checkNodeLimit = atoll(argv[++i]);
+			if (options.checkNodeLimit < 0) {
+				fprintf(stderr, "Invalid number of nodes '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if ((strcmp(arg, "-j") == 0 || strcmp(arg, "--threads") == 0) && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+			if (threads < 1) {
+				fprintf(stderr, "Invalid number of threads '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--timing") == 0) {
+			timing = true;
+		}
+		else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+			printUsage(argv[0]);
+			return 0;
+		}
+		else if (arg[0] == '-' && arg[1] != '\0') {
+			printUsage(argv[0]);
+			return 2;
+		}
+		else {
+			count = atoll(arg);
+		}
+	}
+	if (count < 0) {
+		printUsage(argv[0]);
+		return 2;
+	}
+	if (options.boxWidth * options.boxHeight > largestDigit(encoding)) {
+		fprintf(stderr, "Boxes of %dx%d have more digits than the encoding can write (at most %d)\n", options.boxWidth,
+			options.boxHeight, largestDigit(encoding));
+		return 2;
+	}
+
+	static char outputBuffer[1 << 20];
+	setvbuf(stdout, outputBuffer, _IOFBF, sizeof(outputBuffer));
+
+	int size = options.boxWidth * options.boxHeight;
+	std::vector<char> line((size_t)size * size + 1);
+	long long totalClues = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	generatePuzzles(options, (unsigned long long)count, threads, [&](unsigned long long, const Sudoku& puzzle, int clues) {
+		size_t n = formatPuzzle(puzzle, encoding, line.data());
+		line[n++] = '\n';
+		fwrite(line.data(), 1, n, stdout);
+		totalClues += clues;
+	});
+	fflush(stdout);
+
+	if (timing) {
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stderr, "%lld puzzles in %.3f s (%.1f puzzles/s), %.1f clues on average\n", count, seconds,
+			seconds > 0 ? count / seconds : 0.0, count > 0 ? (double)totalClues / count : 0.0);
+	}
+	return 0;
+}
@@ -0,0 +1,120 @@
+// Sudoku Server.cpp : Keeps a pool of warm solver threads and answers puzzles sent over a Unix domain socket or a
+// loopback TCP port, see SolveServer.h for the protocol.
+//
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "SolveServer.h"
+
+static void printUsage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options] (--socket PATH | --port N)\n"
+		"\n"
+		"Solves puzzles sent to a Unix domain socket or a TCP port on the loopback address until\n"
+		"it is interrupted, then writes its metrics to standard error. Each message is a 4 byte\n"
+		"little endian length and a payload, described in SolveServer.h.\n"
+		"\n"
+		"Options:\n"
+		"      --socket PATH     listen on a Unix domain socket at PATH\n"
+		"      --port N          listen on port N of 127.0.0.1, 0 picks a free port and reports it\n"
+		"  -j, --threads N       number of solver threads (default: one per core)\n"
+		"      --timeout MS      timeout for requests that don't set their own (default: none)\n"
+		"      --max-queued N    stop reading requests while N puzzles are waiting (default 4096)\n"
+		"      --engine NAME     rules (default) or dlx, as for sudoku-cli\n"
+		"  -h, --help            show this message\n",
+		program);
+}
+
+static SolveServer* running = NULL;
+
+static void onSignal(int) {
+	if (running) running->stop();
+}
+
+int main(int argc, char* argv[]) {
+	ServerOptions options;
+	const char* socketPath = NULL;
+	int port = -1;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if (strcmp(arg, "--socket") == 0 && i + 1 < argc) {
+			socketPath = argv[++i];
+		}
+		else if (strcmp(arg, "--port") == 0 && i + 1 < argc) {
+			port = atoi(argv[++i]);
+			if (port < 0 || port > 65535) {
+				fprintf(stderr, "Invalid port '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if ((strcmp(arg, "-j") == 0 || strcmp(arg, "--threads") == 0) && i + 1 < argc) {
+			options.threads = atoi(argv[++i]);
+			if (options.threads < 1) {
+				fprintf(stderr, "Invalid number of threads '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "--timeout") == 0 && i + 1 < argc) {
+			options.timeoutMs = (uint32_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(arg, "--max-queued") == 0 && i + 1 < argc) {
+			long long maxQueued = atoll(argv[++i]);
+			if (maxQueued < 1) {
+				fprintf(stderr, "Invalid queue length '%s'\n", argv[i]);
+				return 2;
+			}
+			options.maxQueued = (size_t)maxQueued;
+		}
+		else if (strcmp(arg, "--engine") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (strcmp(name, "rules") == 0) options.solve.engine = RuleEngine;
+			else if (strcmp(name, "dlx") == 0) options.solve.engine = DancingLinksEngine;
+			else {
+				fprintf(stderr, "Unknown engine '%s'\n", name);
+				return 2;
+			}
+		}
+		else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+			printUsage(argv[0]);
+			return 0;
+		}
+		else {
+			printUsage(argv[0]);
+			return 2;
+		}
+	}
+	if ((socketPath == NULL) == (port < 0)) {
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	SolveServer server(options);
+	if (socketPath != NULL && !server.listenUnix(socketPath)) {
+		fprintf(stderr, "Could not listen on '%s': %s\n", socketPath, strerror(errno));
+		return 2;
+	}
+	if (port >= 0) {
+		if (!server.listenTcp(port)) {
+			fprintf(stderr, "Could not listen on port %d: %s\n", port, strerror(errno));
+			return 2;
+		}
+		fprintf(stderr, "Listening on 127.0.0.1:%d\n", server.port());
+	}
+
+	running = &server;
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	signal(SIGPIPE, SIG_IGN);
+	server.run();
+	running = NULL;
+
+	ServerMetrics metrics = server.metrics();
+	fprintf(stderr, "%lld requests: %lld solved, %lld timed out, %lld invalid. At most %lld queued, %.1f puzzles a batch, %.3f ms mean wait\n",
+		metrics.requests, metrics.solved, metrics.timedOut, metrics.invalid, metrics.maxQueued, metrics.meanBatch, metrics.meanWaitMs);
+	return 0;
+}
@@ -0,0 +1,127 @@
+#include "AsyncSolver.h"
+
+// The executor whose thread this is, if any
+static thread_local const SolveExecutor* currentExecutor = NULL;
+
+SolveExecutor::SolveExecutor(int threads, size_t maxInFlight) {
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	if (threads <= 0) threads = 1;
+	m_maxInFlight = maxInFlight > 0 ? maxInFlight : (size_t)threads * 256;
+	m_inFlight = 0;
+	m_stopping = false;
+	for (int i = 0; i < threads; i++) {
+		m_workers.emplace_back(&SolveExecutor::work, this);
+	}
+}
+
+SolveExecutor::~SolveExecutor() {
+	wait();
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_stopping = true;
+	}
+	m_queueSignal.notify_all();
+	for (std::thread& worker : m_workers) {
+		worker.join();
+	}
+}
+
+SolveExecutor& SolveExecutor::shared() {
+	static SolveExecutor* executor = new SolveExecutor();
+	return *executor;
+}
+
+std::unique_ptr<SolveExecutor::Task> SolveExecutor::reserve(bool block) {
+	std::unique_lock<std::mutex> guard(m_lock);
+	if (m_inFlight >= m_maxInFlight && currentExecutor != this) {
+		if (!block) return NULL;
+		m_doneSignal.wait(guard, [&] { return m_inFlight < m_maxInFlight; });
+	}
+	m_inFlight++;
+	if (m_freeTasks.empty()) return std::unique_ptr<Task>(new Task());
+	std::unique_ptr<Task> task = std::move(m_freeTasks.back());
+	m_freeTasks.pop_back();
+	return task;
+}
+
+void SolveExecutor::enqueue(std::unique_ptr<Task> task, const Sudoku& s, const SolveOptions& options) {
+	// Copied before taking the lock, into the memory the task's last grid used
+	task->result.sudoku = s;
+	task->options = options;
+	task->options.stats = &task->result.stats;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_queue.push_back(std::move(task));
+	}
+	m_queueSignal.notify_one();
+}
+
+std::future<SolveResult> SolveExecutor::submit(const Sudoku& s, const SolveOptions& options) {
+	std::unique_ptr<Task> task = reserve(true);
+	task->promise = std::promise<SolveResult>();
+	std::future<SolveResult> result = task->promise.get_future();
+	enqueue(std::move(task), s, options);
+	return result;
+}
+
+void SolveExecutor::submit(const Sudoku& s, const SolveOptions& options, SolveCompletion onDone) {
+	std::unique_ptr<Task> task = reserve(true);
+	task->onDone = std::move(onDone);
+	enqueue(std::move(task), s, options);
+}
+
+bool SolveExecutor::trySubmit(const Sudoku& s, const SolveOptions& options, std::future<SolveResult>& result) {
+	std::unique_ptr<Task> task = reserve(false);
+	if (!task) return false;
+	task->promise = std::promise<SolveResult>();
+	result = task->promise.get_future();
+	enqueue(std::move(task), s, options);
+	return true;
+}
+
+bool SolveExecutor::trySubmit(const Sudoku& s, const SolveOptions& options, SolveCompletion onDone) {
+	std::unique_ptr<Task> task = reserve(false);
+	if (!task) return false;
+	task->onDone = std::move(onDone);
+	enqueue(std::move(task), s, options);
+	return true;
+}
+
+void SolveExecutor::wait() {
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_doneSignal.wait(guard, [&] { return m_inFlight == 0; });
+}
+
+size_t SolveExecutor::inFlight() const {
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_inFlight;
+}
+
+void SolveExecutor::work() {
+	currentExecutor = this;
+	std::unique_lock<std::mutex> guard(m_lock);
+	while (true) {
+		m_queueSignal.wait(guard, [&] { return !m_queue.empty() || m_stopping; });
+		if (m_queue.empty()) return;
+		std::unique_ptr<Task> task = std::move(m_queue.front());
+		m_queue.pop_front();
+		guard.unlock();
+
+		SolveResult& result = task->result;
+		result.status = Solve(result.sudoku, task->options);
+		if (task->onDone) {
+			task->onDone(result);
+			task->onDone = nullptr;
+		}
+		else {
+			task->promise.set_value(std::move(result));
+		}
+		// Let go of anything the options hold on to, such as the captures of onSolution
+		task->options = SolveOptions();
+
+		guard.lock();
+		m_freeTasks.push_back(std::move(task));
+		m_inFlight--;
+		m_doneSignal.notify_all();
+	}
+}
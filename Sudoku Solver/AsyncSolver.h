@@ -0,0 +1,98 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Solver.h"
+#include "Sudoku.h"
+
+// Solving in the background, so a program with an event loop or I/O of its own doesn't have to tie up a thread waiting
+// for each puzzle. A puzzle handed to a SolveExecutor is copied and solved on one of its threads, and the result comes
+// back through a future or a callback.
+
+// What solving one puzzle came to
+struct SolveResult {
+	Sudoku sudoku; // the grid as Solve() left it: the solution, or as much as could be worked out
+	int status; // what Solve() returned, the number of solutions or SolveAborted
+	SolveStats stats;
+
+	SolveResult() {
+		status = 0;
+	}
+};
+
+// Called with the result on the thread that solved the puzzle. The result can be moved from, it isn't used again.
+typedef std::function<void(SolveResult& result)> SolveCompletion;
+
+// A pool of solver threads that puzzles can be handed to from any thread. At most maxInFlight puzzles are in flight at
+// once, counting from when a puzzle is submitted until its future is ready or its completion has returned, so a producer
+// faster than the solver is held back rather than queueing without end.
+//
+// Puzzles are started in the order they are submitted, each solved with its own options. options.stats is not used, the
+// stats come back with the result. Everything else works as for Solve(), so options.cancel or options.deadline can give
+// up on a puzzle early. Anything options points to, such as a cache or a cancel token, has to last until the result is
+// handed back.
+class SolveExecutor {
+public:
+	// threads of 0 uses every core, maxInFlight of 0 allows 256 puzzles a thread
+	explicit SolveExecutor(int threads = 0, size_t maxInFlight = 0);
+
+	// Waits for every puzzle submitted to be handed back
+	~SolveExecutor();
+
+	// Solve a copy of s, waiting first while maxInFlight puzzles are in flight. Submitting from one of the executor's own
+	// threads, e.g. from a completion, never waits, as that could leave every thread waiting for the others.
+	std::future<SolveResult> submit(const Sudoku& s, const SolveOptions& options = SolveOptions());
+	void submit(const Sudoku& s, const SolveOptions& options, SolveCompletion onDone);
+
+	// As submit, but return false straight away rather than wait when maxInFlight puzzles are in flight, for a caller
+	// such as an event loop that mustn't block
+	bool trySubmit(const Sudoku& s, const SolveOptions& options, std::future<SolveResult>& result);
+	bool trySubmit(const Sudoku& s, const SolveOptions& options, SolveCompletion onDone);
+
+	// Wait until every puzzle submitted so far has been handed back
+	void wait();
+
+	size_t inFlight() const;
+	size_t maxInFlight() const { return m_maxInFlight; }
+	int threads() const { return (int)m_workers.size(); }
+
+	// An executor for the whole program with a thread per core, started the first time it is used. It is never
+	// destroyed, so completions can't run into objects already destroyed as the program exits.
+	static SolveExecutor& shared();
+
+private:
+	// A submitted puzzle. Tasks are kept once they are finished with, so the grids of later puzzles reuse their memory.
+	struct Task {
+		SolveResult result; // holds the copy of the puzzle until it is solved
+		SolveOptions options;
+		SolveCompletion onDone; // empty if the result goes to promise
+		std::promise<SolveResult> promise;
+	};
+
+	size_t m_maxInFlight;
+	std::vector<std::thread> m_workers;
+
+	mutable std::mutex m_lock;
+	std::condition_variable m_queueSignal; // a task has been queued, or the executor is being destroyed
+	std::condition_variable m_doneSignal; // a task has been handed back
+	std::deque<std::unique_ptr<Task>> m_queue;
+	std::vector<std::unique_ptr<Task>> m_freeTasks;
+	size_t m_inFlight;
+	bool m_stopping;
+
+	// Take a task for a new puzzle, counting it as in flight. Returns NULL if block is false and there are already
+	// maxInFlight puzzles in flight.
+	std::unique_ptr<Task> reserve(bool block);
+	void enqueue(std::unique_ptr<Task> task, const Sudoku& s, const SolveOptions& options);
+	void work();
+
+	SolveExecutor(const SolveExecutor&) = delete;
+	SolveExecutor& operator=(const SolveExecutor&) = delete;
+};
@@ -0,0 +1,180 @@
+#include "BatchSolver.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+BatchItem::BatchItem() {
+	numberOfSolutions = 0;
+	valid = false;
+	sequence = 0;
+	tag = 0;
+}
+
+Sudoku& BatchItem::shape(int boxWidth, int boxHeight) {
+	if (sudoku.boxWidth != boxWidth || sudoku.boxHeight != boxHeight) sudoku.reshape(boxWidth, boxHeight);
+	return sudoku;
+}
+
+int defaultBatchThreads() {
+	int threads = (int)std::thread::hardware_concurrency();
+	return threads > 0 ? threads : 1;
+}
+
+size_t defaultBatchWindow(int threads) {
+	return (size_t)(threads > 0 ? threads : defaultBatchThreads()) * 256;
+}
+
+// Puzzles waiting for one worker. The owner takes the oldest puzzle from the front, other workers steal from the back.
+struct WorkQueue {
+	std::mutex lock;
+	std::deque<size_t> slots;
+};
+
+void solveBatch(int threads, size_t window, const std::function<bool(BatchItem&)>& next, const std::function<void(BatchItem&)>& done,
+	const SolveOptions& options) {
+	if (threads <= 0) threads = defaultBatchThreads();
+	if (window == 0) window = defaultBatchWindow(threads);
+
+	if (threads == 1) {
+		BatchItem item;
+		SolveOptions itemOptions = options;
+		itemOptions.stats = &item.stats;
+		for (size_t sequence = 0;; sequence++) {
+			item.sequence = sequence;
+			item.numberOfSolutions = 0;
+			item.stats = SolveStats();
+			if (!next(item)) break;
+			if (item.valid) item.numberOfSolutions = Solve(item.sudoku, itemOptions);
+			done(item);
+		}
+		return;
+	}
+
+	// Item i % window holds puzzle i, so results can be handed back in order by waiting on each slot in turn
+	std::unique_ptr<BatchItem[]> items(new BatchItem[window]);
+	std::unique_ptr<bool[]> solved(new bool[window]());
+	std::mutex solvedLock;
+	std::condition_variable solvedSignal;
+
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+	for (int i = 0; i < threads; i++) {
+		queues.emplace_back(new WorkQueue());
+	}
+	std::mutex idleLock;
+	std::condition_variable idleSignal;
+	size_t queued = 0;
+	bool finished = false;
+
+	auto take = [&](int worker, size_t& slot) {
+		for (int i = 0; i < threads; i++) {
+			WorkQueue& queue = *queues[(worker + i) % threads];
+			std::lock_guard<std::mutex> guard(queue.lock);
+			if (queue.slots.empty()) continue;
+			if (i == 0) {
+				slot = queue.slots.front();
+				queue.slots.pop_front();
+			}
+			else {
+				slot = queue.slots.back();
+				queue.slots.pop_back();
+			}
+			return true;
+		}
+		return false;
+	};
+
+	auto work = [&](int worker) {
+		// Each worker points its own copy of the options at the stats of the item it is solving
+		SolveOptions itemOptions = options;
+		while (true) {
+			size_t slot;
+			if (!take(worker, slot)) {
+				std::unique_lock<std::mutex> guard(idleLock);
+				idleSignal.wait(guard, [&] { return queued > 0 || finished; });
+				if (queued == 0 && finished) return;
+				continue;
+			}
+			{
+				std::lock_guard<std::mutex> guard(idleLock);
+				queued--;
+			}
+
+			BatchItem& item = items[slot];
+			item.stats = SolveStats();
+			itemOptions.stats = &item.stats;
+			item.numberOfSolutions = Solve(item.sudoku, itemOptions);
+
+			{
+				std::lock_guard<std::mutex> guard(solvedLock);
+				solved[slot] = true;
+			}
+			solvedSignal.notify_one();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++) {
+		workers.emplace_back(work, i);
+	}
+
+	size_t nextIn = 0, nextOut = 0;
+	bool more = true;
+	while (more || nextOut < nextIn) {
+		// Hand back every puzzle that is finished, in order. Only wait for one when the window is full or the input has ended.
+		while (nextOut < nextIn) {
+			size_t slot = nextOut % window;
+			{
+				std::unique_lock<std::mutex> guard(solvedLock);
+				if (!solved[slot]) {
+					if (more && nextIn - nextOut < window) break;
+					solvedSignal.wait(guard, [&] { return solved[slot]; });
+				}
+				solved[slot] = false;
+			}
+			done(items[slot]);
+			nextOut++;
+		}
+		if (!more) continue;
+
+		size_t slot = nextIn % window;
+		BatchItem& item = items[slot];
+		item.sequence = nextIn;
+		item.numberOfSolutions = 0;
+		item.stats = SolveStats();
+		if (!next(item)) {
+			more = false;
+			continue;
+		}
+
+		if (item.valid) {
+			WorkQueue& queue = *queues[nextIn % threads];
+			{
+				std::lock_guard<std::mutex> guard(queue.lock);
+				queue.slots.push_back(slot);
+			}
+			{
+				std::lock_guard<std::mutex> guard(idleLock);
+				queued++;
+			}
+			idleSignal.notify_one();
+		}
+		else {
+			std::lock_guard<std::mutex> guard(solvedLock);
+			solved[slot] = true;
+		}
+		nextIn++;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(idleLock);
+		finished = true;
+	}
+	idleSignal.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
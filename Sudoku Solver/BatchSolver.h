@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+#include "Solver.h"
+#include "Sudoku.h"
+
+// One puzzle of a batch. Items are reused for later puzzles, so the sudoku's cells are only reallocated when it grows.
+struct BatchItem {
+	Sudoku sudoku;
+	int numberOfSolutions; // result of Solve(), 0 if the item is not valid
+	SolveStats stats; // what solving it took
+	bool valid; // false if the input couldn't be read as a puzzle, the item is then passed through without being solved
+	size_t sequence; // position in the batch, starting from 0
+	size_t tag; // free for the caller, e.g. the line number the puzzle was read from
+
+	BatchItem();
+
+	// Make sure the sudoku has the given box shape and return it
+	Sudoku& shape(int boxWidth, int boxHeight);
+
+private:
+	BatchItem(const BatchItem&) = delete;
+	BatchItem& operator=(const BatchItem&) = delete;
+};
+
+// Solves a stream of puzzles on several threads.
+//
+// next is called to fill each item in turn and returns false once there are no more puzzles. done is passed every item
+// once it has been solved, in the same order next filled them. Both are only called from the calling thread, which does
+// the reading and writing while the workers solve.
+//
+// Each worker has its own queue of puzzles and takes work from the other queues when its own runs dry, so one very hard
+// puzzle doesn't hold up the puzzles queued behind it. At most window puzzles are in flight at once: when the oldest
+// unfinished puzzle is window puzzles behind the newest, reading waits for it to finish.
+//
+// threads of 0 uses every core, 1 solves everything on the calling thread. Each puzzle is solved with options, filling
+// in the item's stats rather than options.stats.
+void solveBatch(int threads, size_t window, const std::function<bool(BatchItem&)>& next, const std::function<void(BatchItem&)>& done,
+	const SolveOptions& options = SolveOptions());
+
+// Window used when 0 is passed to solveBatch
+size_t defaultBatchWindow(int threads);
+
+// Number of threads used when 0 is passed to solveBatch
+int defaultBatchThreads();
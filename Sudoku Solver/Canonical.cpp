@@ -0,0 +1,475 @@
+#include "Canonical.h"
+#include "DigitMask.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+void applyTransform(const Sudoku& source, const GridTransform& transform, Sudoku& result) {
+	if (result.boxWidth != source.boxWidth || result.boxHeight != source.boxHeight) result.reshape(source.boxWidth, source.boxHeight);
+	for (int x = 0; x < source.size; x++) {
+		for (int y = 0; y < source.size; y++) {
+			int sx = transform.columns[x];
+			int sy = transform.rows[y];
+			CellValue value = transform.transposed ? source.at(sy, sx) : source.at(sx, sy);
+			result.at(x, y) = value > 0 ? (CellValue)transform.digits[value] : value;
+		}
+	}
+}
+
+void undoTransform(const Sudoku& source, const GridTransform& transform, Sudoku& result) {
+	if (result.boxWidth != source.boxWidth || result.boxHeight != source.boxHeight) result.reshape(source.boxWidth, source.boxHeight);
+	int digits[65];
+	for (int d = 1; d <= source.size; d++) {
+		digits[transform.digits[d]] = d;
+	}
+	for (int x = 0; x < source.size; x++) {
+		for (int y = 0; y < source.size; y++) {
+			CellValue value = source.at(x, y);
+			if (value > 0) value = (CellValue)digits[value];
+			int sx = transform.columns[x];
+			int sy = transform.rows[y];
+			if (transform.transposed) result.at(sy, sx) = value;
+			else result.at(sx, sy) = value;
+		}
+	}
+}
+
+// Cells of a row of the result are compared by these, so digits come before blank cells. A digit that hasn't been given a
+// label yet will get the next one, which is larger than any label so far, so it goes after the labelled digits. New
+// digits that are given more often go first, which settles most ties between them without having to try both orders.
+static const int NewDigit = 65; // up to NewDigit + 64 for a digit that is never given
+static const int BlankCell = 200;
+
+// Work allowed before giving up, counted in rows and groups of columns looked at
+static const long long SearchBudget = 1 << 16;
+
+// How far the search has got along one path: the order of the columns so far and the digits labelled so far. Columns in
+// the same group could still come in any order, as could the stacks in the same group of stacks. Every stack in a group
+// has the same groups of columns.
+struct ColumnState {
+	int columns[64]; // column of the source at each column of the result
+	DigitMask columnSplits; // bit p is set where a group of columns starts at column p of the result
+	DigitMask stackSplits; // bit s is set where a group of stacks starts at stack s of the result
+	int labels[65]; // label of each digit of the source, 0 for digits not seen yet
+	int nextLabel;
+	DigitMask rowsUsed; // rows of the source already in the result
+};
+
+// Start of the next group after position p, or end if there isn't one before it
+static int nextSplit(DigitMask splits, int p, int end) {
+	DigitMask above = p >= 63 ? 0 : splits & ~((2ULL << p) - 1);
+	if (!above) return end;
+	int next = lowestBit(above);
+	return next < end ? next : end;
+}
+
+class CanonicalSearch {
+public:
+	CanonicalSearch(const Sudoku& s) : m_grid(s) {
+		m_size = s.size;
+		m_stackWidth = s.boxWidth;
+		m_bandHeight = s.boxHeight;
+		m_stacks = m_size / m_stackWidth;
+		m_bestRows = 0;
+		m_version = 0;
+		m_budget = SearchBudget;
+		m_found = false;
+	}
+
+	// Search the grid as it is and, if the boxes are square, transposed. Returns false if the search gave up.
+	bool run(GridTransform& transform) {
+		// The rows have to be the side whose bands have the larger keys, so both are only searched if they tie
+		int orientation = 0;
+		if (m_stackWidth == m_bandHeight) {
+			m_transposed = false;
+			countClues();
+			orientation = compareKeyLists(m_bandKeys, m_stackKeys, m_stacks);
+		}
+		for (int transposed = 0; transposed < 2; transposed++) {
+			if (transposed ? orientation > 0 || m_stackWidth != m_bandHeight : orientation < 0) continue;
+			m_transposed = transposed != 0;
+			countClues();
+
+			// The stacks start off in order of their keys, and the columns of each stack in order of their clues. Stacks
+			// and columns that tie make up the first groups.
+			ColumnState state;
+			int stacks[64];
+			for (int s = 0; s < m_stacks; s++) {
+				stacks[s] = s;
+			}
+			std::sort(stacks, stacks + m_stacks, [&](int a, int b) { return compareKeys(m_stackKeys[a], m_stackKeys[b], m_stackWidth) > 0; });
+			state.columnSplits = 0;
+			state.stackSplits = 0;
+			for (int s = 0; s < m_stacks; s++) {
+				if (s == 0 || compareKeys(m_stackKeys[stacks[s - 1]], m_stackKeys[stacks[s]], m_stackWidth) != 0) state.stackSplits |= 1ULL << s;
+				int* columns = state.columns + s * m_stackWidth;
+				for (int i = 0; i < m_stackWidth; i++) {
+					columns[i] = stacks[s] * m_stackWidth + i;
+				}
+				std::sort(columns, columns + m_stackWidth, [&](int a, int b) { return m_columnClues[a] > m_columnClues[b]; });
+				for (int i = 0; i < m_stackWidth; i++) {
+					if (i == 0 || m_columnClues[columns[i - 1]] != m_columnClues[columns[i]]) {
+						state.columnSplits |= 1ULL << (s * m_stackWidth + i);
+					}
+				}
+			}
+			memset(state.labels, 0, sizeof(state.labels));
+			state.nextLabel = 1;
+			state.rowsUsed = 0;
+			nextRow(state, 0);
+			if (m_budget < 0) return false;
+		}
+		transform = m_transform;
+		return m_found;
+	}
+
+private:
+	const Sudoku& m_grid;
+	bool m_transposed;
+	int m_size, m_stackWidth, m_bandHeight, m_stacks;
+	int m_rows[64]; // row of the source at each row of the result along the current path
+	int m_tokens[64][64]; // each row of the result along the current path
+	int m_best[64][64]; // the smallest result so far, row by row
+	int m_bestRows; // rows of m_best that are known, the rest are still open
+	int m_version; // changes whenever m_best does
+	long long m_budget;
+	bool m_found;
+	GridTransform m_transform; // transform giving m_best
+
+	// Clues in each row and column, and the key of each band and stack: its clues, then the clues of its rows or columns
+	// from most to fewest. None of these change when the grid is transformed, so the rows and columns are only ever put
+	// in order of them, bands and stacks with the larger keys first, and the search only has to choose between ties.
+	int m_rowClues[64];
+	int m_columnClues[64];
+	int m_digitClues[65]; // clues of each digit
+	int m_bandKeys[64][65];
+	int m_stackKeys[64][65];
+
+	// How a row being built compares with the same row of m_best, worked out again whenever m_best has changed
+	struct Comparison {
+		int order; // -1 already smaller, 0 the same so far
+		int version;
+	};
+
+	void countClues() {
+		for (int i = 0; i < m_size; i++) {
+			m_rowClues[i] = 0;
+			m_columnClues[i] = 0;
+			m_digitClues[i + 1] = 0;
+		}
+		for (int column = 0; column < m_size; column++) {
+			for (int row = 0; row < m_size; row++) {
+				int v = value(column, row);
+				if (v > 0) {
+					m_rowClues[row]++;
+					m_columnClues[column]++;
+					m_digitClues[v]++;
+				}
+			}
+		}
+		for (int band = 0; band < m_size / m_bandHeight; band++) {
+			groupKey(m_rowClues + band * m_bandHeight, m_bandHeight, m_bandKeys[band]);
+		}
+		for (int stack = 0; stack < m_stacks; stack++) {
+			groupKey(m_columnClues + stack * m_stackWidth, m_stackWidth, m_stackKeys[stack]);
+		}
+	}
+
+	static void groupKey(const int* lineClues, int lines, int* key) {
+		key[0] = 0;
+		for (int i = 0; i < lines; i++) {
+			key[i + 1] = lineClues[i];
+			key[0] += lineClues[i];
+		}
+		std::sort(key + 1, key + 1 + lines, std::greater<int>());
+	}
+
+	static int compareKeys(const int* a, const int* b, int lines) {
+		for (int i = 0; i <= lines; i++) {
+			if (a[i] != b[i]) return a[i] > b[i] ? 1 : -1;
+		}
+		return 0;
+	}
+
+	// Compare the keys of two sets of groups, each from largest to smallest. Only used for square boxes, where bands and
+	// stacks have the same number of lines.
+	int compareKeyLists(int (*a)[65], int (*b)[65], int groups) const {
+		int orderA[64], orderB[64];
+		for (int i = 0; i < groups; i++) {
+			orderA[i] = i;
+			orderB[i] = i;
+		}
+		std::sort(orderA, orderA + groups, [&](int x, int y) { return compareKeys(a[x], a[y], m_stackWidth) > 0; });
+		std::sort(orderB, orderB + groups, [&](int x, int y) { return compareKeys(b[x], b[y], m_stackWidth) > 0; });
+		for (int i = 0; i < groups; i++) {
+			int order = compareKeys(a[orderA[i]], b[orderB[i]], m_stackWidth);
+			if (order) return order;
+		}
+		return 0;
+	}
+
+	int value(int column, int row) const {
+		return m_transposed ? m_grid.at(row, column) : m_grid.at(column, row);
+	}
+
+	int token(const ColumnState& state, int column, int row) const {
+		int v = value(column, row);
+		if (v <= 0) return BlankCell;
+		return state.labels[v] ? state.labels[v] : NewDigit + m_size - m_digitClues[v];
+	}
+
+	// Add a cell to the row of the result at this depth. Returns false if the row is now bigger than the best one.
+	bool emit(int depth, int p, int token, Comparison& comparison) {
+		m_tokens[depth][p] = token;
+		if (depth >= m_bestRows) return true;
+		if (comparison.version != m_version) {
+			comparison.version = m_version;
+			comparison.order = 0;
+			for (int i = 0; i < p && comparison.order == 0; i++) {
+				if (m_tokens[depth][i] != m_best[depth][i]) comparison.order = m_tokens[depth][i] < m_best[depth][i] ? -1 : 1;
+			}
+			if (comparison.order > 0) return false;
+		}
+		if (comparison.order == 0 && token != m_best[depth][p]) {
+			if (token > m_best[depth][p]) return false;
+			comparison.order = -1;
+		}
+		return true;
+	}
+
+	// Sort the columns of the group starting at p into the order their cells in the row should come in
+	void sortGroup(ColumnState& state, int row, int p, int end) const {
+		for (int i = p + 1; i < end; i++) {
+			int column = state.columns[i];
+			int t = token(state, column, row);
+			int j = i;
+			for (; j > p && token(state, state.columns[j - 1], row) > t; j--) {
+				state.columns[j] = state.columns[j - 1];
+			}
+			state.columns[j] = column;
+		}
+	}
+
+	void nextRow(ColumnState& state, int depth) {
+		if (depth == m_size) {
+			record(state);
+			return;
+		}
+		// A new band may be any unused band with the largest key, otherwise the row has to come from the same band as the
+		// one before. Either way it has to be one of the rows of the band with the most clues left.
+		DigitMask bands = 0;
+		if (depth % m_bandHeight == 0) {
+			int largest = -1;
+			for (int band = 0; band < m_size / m_bandHeight; band++) {
+				if (state.rowsUsed & (allDigits(m_bandHeight) << (band * m_bandHeight))) continue;
+				int order = largest < 0 ? 1 : compareKeys(m_bandKeys[band], m_bandKeys[largest], m_bandHeight);
+				if (order > 0) {
+					largest = band;
+					bands = 0;
+				}
+				if (order >= 0) bands |= 1ULL << band;
+			}
+		}
+		else {
+			bands = 1ULL << (m_rows[depth - 1] / m_bandHeight);
+		}
+		int mostClues = -1;
+		for (int row = 0; row < m_size; row++) {
+			if (!(state.rowsUsed & (1ULL << row)) && (bands & (1ULL << (row / m_bandHeight))) && m_rowClues[row] > mostClues) {
+				mostClues = m_rowClues[row];
+			}
+		}
+		for (int row = 0; row < m_size; row++) {
+			if (state.rowsUsed & (1ULL << row)) continue;
+			if (!(bands & (1ULL << (row / m_bandHeight))) || m_rowClues[row] != mostClues) continue;
+			m_rows[depth] = row;
+			Comparison comparison = { 0, -1 };
+			placeStacks(state, row, 0, depth, comparison);
+			if (m_budget < 0) return;
+		}
+	}
+
+	// Lay out the row from stack slot onwards. Each group of stacks is put in order of the smallest arrangement of the
+	// row's cells each stack allows, and stacks that tie stay in a group unless the tie puts new digits in different places.
+	void placeStacks(ColumnState state, int row, int slot, int depth, Comparison comparison) {
+		if (--m_budget < 0) return;
+		if (slot == m_stacks) {
+			finishRow(state, row, depth);
+			return;
+		}
+		int end = nextSplit(state.stackSplits, slot, m_stacks);
+
+		// Smallest arrangement of the row in each stack of the group
+		for (int s = slot; s < end; s++) {
+			int first = s * m_stackWidth;
+			for (int p = first; p < first + m_stackWidth; p = nextSplit(state.columnSplits, p, first + m_stackWidth)) {
+				sortGroup(state, row, p, nextSplit(state.columnSplits, p, first + m_stackWidth));
+			}
+		}
+		int smallest[64];
+		stackTokens(state, row, slot, smallest);
+		bool hasNewDigit = false;
+		for (int s = slot + 1; s < end; s++) {
+			int tokens[64];
+			stackTokens(state, row, s, tokens);
+			if (compareTokens(tokens, smallest) < 0) memcpy(smallest, tokens, sizeof(int) * m_stackWidth);
+		}
+		for (int i = 0; i < m_stackWidth; i++) {
+			if (smallest[i] >= NewDigit && smallest[i] < BlankCell) hasNewDigit = true;
+		}
+
+		if (!hasNewDigit) {
+			// The tied stacks stay a group, split up the same way by the row
+			int next = slot;
+			for (int s = slot; s < end; s++) {
+				int tokens[64];
+				stackTokens(state, row, s, tokens);
+				if (compareTokens(tokens, smallest) == 0) moveStack(state, s, next++);
+			}
+			state.stackSplits |= 1ULL << slot;
+			if (next < m_stacks) state.stackSplits |= 1ULL << next;
+			for (int s = slot; s < next; s++) {
+				int first = s * m_stackWidth;
+				for (int i = 0; i < m_stackWidth; i++) {
+					if (i == 0 || smallest[i] != smallest[i - 1]) state.columnSplits |= 1ULL << (first + i);
+					if (!emit(depth, first + i, smallest[i], comparison)) return;
+				}
+			}
+			placeStacks(state, row, next, depth, comparison);
+			return;
+		}
+
+		// Labels go to the new digits in the order they come, so which of the tied stacks comes first has to be tried
+		for (int s = slot; s < end && m_budget >= 0; s++) {
+			int tokens[64];
+			stackTokens(state, row, s, tokens);
+			if (compareTokens(tokens, smallest) != 0) continue;
+			ColumnState chosen = state;
+			moveStack(chosen, s, slot);
+			chosen.stackSplits |= 1ULL << slot;
+			if (slot + 1 < m_stacks) chosen.stackSplits |= 1ULL << (slot + 1);
+			placeColumns(chosen, row, slot, slot * m_stackWidth, depth, comparison);
+		}
+	}
+
+	// Lay out the row in the group of columns starting at p, which is in a stack whose place is settled
+	void placeColumns(ColumnState state, int row, int slot, int p, int depth, Comparison comparison) {
+		if (--m_budget < 0) return;
+		int stackEnd = (slot + 1) * m_stackWidth;
+		if (p == stackEnd) {
+			placeStacks(state, row, slot + 1, depth, comparison);
+			return;
+		}
+		int end = nextSplit(state.columnSplits, p, stackEnd);
+		sortGroup(state, row, p, end);
+
+		// Digits already labelled each get a column of their own
+		for (; p < end; p++) {
+			int t = token(state, state.columns[p], row);
+			if (t >= NewDigit) break;
+			state.columnSplits |= 1ULL << p;
+			if (!emit(depth, p, t, comparison)) return;
+		}
+		int t = p < end ? token(state, state.columns[p], row) : BlankCell;
+		if (t < BlankCell) {
+			// The next label may go to any of the new digits given the most often
+			int newDigits = 0;
+			while (p + newDigits < end && token(state, state.columns[p + newDigits], row) == t) newDigits++;
+			for (int i = 0; i < newDigits && m_budget >= 0; i++) {
+				ColumnState chosen = state;
+				int column = chosen.columns[p + i];
+				chosen.columns[p + i] = chosen.columns[p];
+				chosen.columns[p] = column;
+				int label = chosen.nextLabel++;
+				chosen.labels[value(column, row)] = label;
+				chosen.columnSplits |= 1ULL << p;
+				if (p + 1 < m_size) chosen.columnSplits |= 1ULL << (p + 1);
+				Comparison branch = comparison;
+				if (!emit(depth, p, label, branch)) continue;
+				placeColumns(chosen, row, slot, p + 1, depth, branch);
+			}
+			return;
+		}
+		// The blank cells that are left stay a group
+		if (p < end) state.columnSplits |= 1ULL << p;
+		for (; p < end; p++) {
+			if (!emit(depth, p, BlankCell, comparison)) return;
+		}
+		placeColumns(state, row, slot, end, depth, comparison);
+	}
+
+	// The row's cells in a stack whose groups of columns have been sorted, which is the smallest arrangement it allows
+	void stackTokens(const ColumnState& state, int row, int s, int* tokens) const {
+		for (int i = 0; i < m_stackWidth; i++) {
+			tokens[i] = token(state, state.columns[s * m_stackWidth + i], row);
+		}
+	}
+
+	int compareTokens(const int* a, const int* b) const {
+		for (int i = 0; i < m_stackWidth; i++) {
+			if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+		}
+		return 0;
+	}
+
+	// Swap the columns of two stacks, which are in the same group so are split into groups of columns the same way
+	void moveStack(ColumnState& state, int from, int to) const {
+		if (from == to) return;
+		for (int i = 0; i < m_stackWidth; i++) {
+			int swap = state.columns[from * m_stackWidth + i];
+			state.columns[from * m_stackWidth + i] = state.columns[to * m_stackWidth + i];
+			state.columns[to * m_stackWidth + i] = swap;
+		}
+	}
+
+	void finishRow(ColumnState& state, int row, int depth) {
+		const int* tokens = m_tokens[depth];
+		if (depth < m_bestRows) {
+			int order = 0;
+			for (int p = 0; p < m_size && order == 0; p++) {
+				if (tokens[p] != m_best[depth][p]) order = tokens[p] < m_best[depth][p] ? -1 : 1;
+			}
+			if (order > 0) return;
+			if (order < 0) {
+				// Every row after this one has to be found again
+				memcpy(m_best[depth], tokens, sizeof(int) * m_size);
+				m_bestRows = depth + 1;
+				m_version++;
+			}
+		}
+		else {
+			memcpy(m_best[depth], tokens, sizeof(int) * m_size);
+			m_bestRows = depth + 1;
+			m_version++;
+		}
+		state.rowsUsed |= 1ULL << row;
+		nextRow(state, depth + 1);
+	}
+
+	// The path has reached the end and is at least as small as anything found before it
+	void record(const ColumnState& state) {
+		m_found = true;
+		m_transform.transposed = m_transposed;
+		for (int i = 0; i < m_size; i++) {
+			m_transform.columns[i] = state.columns[i];
+			m_transform.rows[i] = m_rows[i];
+		}
+		// Digits that don't appear can be labelled in any order
+		int nextLabel = state.nextLabel;
+		for (int d = 1; d <= m_size; d++) {
+			m_transform.digits[d] = state.labels[d] ? state.labels[d] : nextLabel++;
+		}
+	}
+};
+
+bool canonicalize(const Sudoku& s, Sudoku& canonical, GridTransform& transform) {
+	if (s.size <= 0 || s.size > MaxSudokuSize) return false;
+	for (CellValue value : s.all()) {
+		if (value < -1 || value > s.size) return false;
+	}
+	CanonicalSearch search(s);
+	if (!search.run(transform)) return false;
+	applyTransform(s, transform, canonical);
+	return true;
+}
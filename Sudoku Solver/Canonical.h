@@ -0,0 +1,33 @@
+#pragma once
+#include "Sudoku.h"
+
+// A relabelling of the digits together with a reordering of the grid that keeps every box, row and column a box, row or
+// column: the rows within a band of boxes, the bands, the columns within a stack of boxes and the stacks, and for square
+// boxes swapping the rows for the columns. A transformed sudoku has the same number of solutions, transformed the same way.
+struct GridTransform {
+	bool transposed; // rows and columns are swapped before anything else, only ever set for square boxes
+	int columns[64]; // column of the (transposed) source each column of the result comes from
+	int rows[64]; // row of the (transposed) source each row of the result comes from
+	int digits[65]; // digit of the result for each digit of the source, digits[0] is unused
+};
+
+// Transform source into result, giving result the shape of source if it doesn't have it already
+void applyTransform(const Sudoku& source, const GridTransform& transform, Sudoku& result);
+
+// Undo a transform: result is the sudoku that gives source when transform is applied to it
+void undoTransform(const Sudoku& source, const GridTransform& transform, Sudoku& result);
+
+// The canonical form of a sudoku is the smallest of its transforms, reading the cells row by row with the digits labelled
+// in the order they first appear and coming before blank cells. Only transforms that put the bands, rows, stacks and
+// columns in order of their number of clues are looked at, and where new digits tie the one given most often comes
+// first. None of that depends on how the sudoku was transformed, so every transform of a sudoku has the same canonical
+// form and it can be used to spot the same puzzle coming back relabelled, reordered or transposed.
+//
+// The search builds the result one row at a time, trying every row that may come next and keeping only those that are
+// no worse than the best so far. The column order is left open until a row tells columns apart, so most choices are made
+// once rather than for every arrangement of the columns. Grids with a lot of symmetry, such as a nearly empty or a
+// completely filled one, can leave too many choices open, so the search gives up after a fixed amount of work.
+//
+// Returns false if the search gave up or the sudoku has black cells, otherwise canonical is the canonical form and
+// applying transform to s gives it.
+bool canonicalize(const Sudoku& s, Sudoku& canonical, GridTransform& transform);
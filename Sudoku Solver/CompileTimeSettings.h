@@ -1,5 +1,5 @@
 #pragma once
 
+// Box shape the GUI starts with, which can then be changed with control and the arrow keys
 #define BOX_WIDTH 3
 #define BOX_HEIGHT 3
-#define SUDOKU_SIZE ( BOX_WIDTH * BOX_HEIGHT )
@@ -0,0 +1,247 @@
+#include "DancingLinks.h"
+
+#include <climits>
+#include <memory>
+
+DancingLinks::DancingLinks(int boxWidth, int boxHeight) {
+	m_boxWidth = boxWidth;
+	m_boxHeight = boxHeight;
+	m_size = boxWidth * boxHeight;
+	int cells = m_size * m_size;
+	m_numberOfColumns = 4 * cells;
+
+	size_t nodes = 1 + (size_t)m_numberOfColumns + 4 * (size_t)cells * m_size;
+	m_left.resize(nodes);
+	m_right.resize(nodes);
+	m_up.resize(nodes);
+	m_down.resize(nodes);
+	m_column.resize(nodes);
+	m_candidate.resize(nodes, -1);
+	m_count.assign(m_numberOfColumns + 1, 0);
+
+	// The root and the column headers form one circular list
+	for (int i = 0; i <= m_numberOfColumns; i++) {
+		m_left[i] = i == 0 ? m_numberOfColumns : i - 1;
+		m_right[i] = i == m_numberOfColumns ? 0 : i + 1;
+		m_up[i] = i;
+		m_down[i] = i;
+		m_column[i] = i;
+	}
+
+	// Columns 1 to cells are the cells, then each row, column and box has one column per digit
+	int node = m_numberOfColumns + 1;
+	for (int cell = 0; cell < cells; cell++) {
+		int x = cell / m_size;
+		int y = cell % m_size;
+		int box = (x / boxWidth) * boxWidth + y / boxHeight;
+		for (int d = 0; d < m_size; d++) {
+			int columns[4] = {
+				1 + cell,
+				1 + cells + y * m_size + d,
+				1 + 2 * cells + x * m_size + d,
+				1 + 3 * cells + box * m_size + d
+			};
+			for (int k = 0; k < 4; k++) {
+				int i = node + k;
+				int c = columns[k];
+				m_column[i] = c;
+				m_candidate[i] = cell * m_size + d;
+				m_left[i] = node + (k + 3) % 4;
+				m_right[i] = node + (k + 1) % 4;
+				m_up[i] = m_up[c];
+				m_down[i] = c;
+				m_down[m_up[c]] = i;
+				m_up[c] = i;
+				m_count[c]++;
+			}
+			node += 4;
+		}
+	}
+}
+
+// Take a column out of the header list and every row that covers it out of the other columns
+void DancingLinks::cover(int column) {
+	m_right[m_left[column]] = m_right[column];
+	m_left[m_right[column]] = m_left[column];
+	for (int i = m_down[column]; i != column; i = m_down[i]) {
+		for (int j = m_right[i]; j != i; j = m_right[j]) {
+			m_down[m_up[j]] = m_down[j];
+			m_up[m_down[j]] = m_up[j];
+			m_count[m_column[j]]--;
+		}
+	}
+}
+
+// Exactly undo cover(), which only works in the reverse order the columns were covered
+void DancingLinks::uncover(int column) {
+	for (int i = m_up[column]; i != column; i = m_up[i]) {
+		for (int j = m_left[i]; j != i; j = m_left[j]) {
+			m_count[m_column[j]]++;
+			m_down[m_up[j]] = j;
+			m_up[m_down[j]] = j;
+		}
+	}
+	m_right[m_left[column]] = column;
+	m_left[m_right[column]] = column;
+}
+
+// The column with the fewest rows left, 0 when every column is covered
+int DancingLinks::chooseColumn() const {
+	int best = 0;
+	int fewest = INT_MAX;
+	for (int c = m_right[0]; c != 0; c = m_right[c]) {
+		if (m_count[c] < fewest) {
+			best = c;
+			fewest = m_count[c];
+			if (fewest <= 1) break;
+		}
+	}
+	return best;
+}
+
+int DancingLinks::solve(Sudoku& s, const SolveOptions& options) {
+	int cells = m_size * m_size;
+	std::vector<int>& values = m_values;
+	values.resize(cells);
+	for (int cell = 0; cell < cells; cell++) {
+		values[cell] = s[cell] > 0 ? s[cell] : 0;
+	}
+
+	// Givens are chosen before the search starts. A given whose columns have already been covered by another given
+	// breaks the rules, so there is no solution, and so does a given larger than any digit, which has no row at all.
+	std::vector<int>& givens = m_givens;
+	std::vector<char>& covered = m_covered;
+	givens.clear();
+	covered.assign(m_numberOfColumns + 1, 0);
+	bool valid = true;
+	for (int cell = 0; cell < cells && valid; cell++) {
+		if (values[cell] <= 0) continue;
+		if (values[cell] > m_size) {
+			valid = false;
+			break;
+		}
+		int row = m_numberOfColumns + 1 + 4 * (cell * m_size + values[cell] - 1);
+		for (int k = 0; k < 4; k++) {
+			if (covered[m_column[row + k]]) valid = false;
+		}
+		if (!valid) break;
+		for (int k = 0; k < 4; k++) {
+			covered[m_column[row + k]] = 1;
+			cover(m_column[row + k]);
+		}
+		givens.push_back(row);
+	}
+
+	long long limit = options.solutionLimit();
+	long long found = 0;
+	std::vector<int>& first = m_first;
+	std::vector<int>& chosen = m_chosen;
+	chosen.clear();
+
+	// Select a row, covering every column it has apart from the one it was chosen from
+	auto select = [&](int row) {
+		for (int j = m_right[row]; j != row; j = m_right[j]) cover(m_column[j]);
+	};
+	auto deselect = [&](int row) {
+		for (int j = m_left[row]; j != row; j = m_left[j]) uncover(m_column[j]);
+	};
+
+	// Only the limits of the state are used, the rest is kept in locals as this search is always on one thread
+	SearchState state(options);
+	long long nodes = 0; // rows selected since the limits were last checked
+	long long nextCheck = state.checkInterval();
+
+	bool stop = !valid;
+	bool descend = true;
+	while (!stop) {
+		if (nodes == nextCheck) {
+			if (!state.withinLimits(nodes)) break;
+			nextCheck = state.checkInterval();
+		}
+		if (descend) {
+			if (m_right[0] == 0) {
+				// Every column is covered exactly once
+				for (int row : chosen) {
+					values[m_candidate[row] / m_size] = m_candidate[row] % m_size + 1;
+				}
+				if (++found == 1) first = values;
+				if (options.onSolution && !options.onSolution(values)) stop = true;
+				if (found == limit) stop = true;
+				descend = false;
+				continue;
+			}
+
+			int c = chooseColumn();
+			if (m_count[c] > 0) {
+				cover(c);
+				chosen.push_back(m_down[c]);
+				select(m_down[c]);
+				nodes++;
+				continue;
+			}
+			descend = false;
+		}
+
+		// Move the deepest choice on to the next row of its column, or give up the column once every row has been tried
+		if (chosen.empty()) break;
+		int row = chosen.back();
+		deselect(row);
+		int c = m_column[row];
+		row = m_down[row];
+		if (row == c) {
+			uncover(c);
+			chosen.pop_back();
+			continue;
+		}
+		chosen.back() = row;
+		select(row);
+		nodes++;
+		descend = true;
+	}
+
+	// Put the matrix back as it was for the next sudoku
+	while (!chosen.empty()) {
+		deselect(chosen.back());
+		uncover(m_column[chosen.back()]);
+		chosen.pop_back();
+	}
+	for (size_t g = givens.size(); g-- > 0;) {
+		for (int k = 4; k-- > 0;) {
+			uncover(m_column[givens[g] + k]);
+		}
+	}
+
+	state.nodes += nodes;
+	AbortReason aborted = (AbortReason)state.aborted.load();
+	if (options.stats) {
+		options.stats->nodes = state.nodes;
+		options.stats->solutions = found;
+		options.stats->aborted = aborted;
+	}
+
+	if (aborted != NotAborted ? found > 0 : found == 1 || (options.mode == FindAny && found > 0)) {
+		for (int cell = 0; cell < cells; cell++) {
+			s[cell] = (CellValue)first[cell];
+		}
+	}
+	if (aborted != NotAborted) return SolveAborted;
+	return found > INT_MAX ? INT_MAX : (int)found;
+}
+
+int solveExactCover(Sudoku& s, const SolveOptions& options) {
+	// Building the matrix costs more than solving most puzzles, so each thread keeps the last one it built
+	thread_local std::unique_ptr<DancingLinks> matrix;
+	thread_local bool inUse = false; // a solve on this thread is using the matrix, e.g. Solve() has been called from onSolution
+	if (inUse) {
+		// Only a nested solve gets a matrix of its own
+		DancingLinks nested(s.boxWidth, s.boxHeight);
+		return nested.solve(s, options);
+	}
+	if (!matrix || matrix->boxWidth() != s.boxWidth || matrix->boxHeight() != s.boxHeight) {
+		matrix.reset(new DancingLinks(s.boxWidth, s.boxHeight));
+	}
+	inUse = true;
+	int numberOfSolutions = matrix->solve(s, options);
+	inUse = false;
+	return numberOfSolutions;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+
+#include "Solver.h"
+#include "Sudoku.h"
+
+// Sudoku as an exact cover problem, solved with Knuth's Algorithm X on a dancing links matrix.
+//
+// Every candidate (cell, digit) is a matrix row covering four columns: the cell is filled, and the digit is placed in
+// its row, its column and its box. A solution is a set of rows covering every column exactly once. Each row and column
+// of the matrix is a circular doubly linked list so a column can be taken out and put back in constant time per node.
+//
+// Nodes are held in flat arrays and linked by index. Node 0 is the root, nodes 1 to numberOfColumns are the column
+// headers and the four nodes of each candidate follow.
+class DancingLinks {
+public:
+	DancingLinks(int boxWidth, int boxHeight);
+
+	// Solve as Solve() does, using options.mode, options.limit, options.onSolution and the limits on the search. The search
+	// is always made on the calling thread. Returns the number of solutions found or SolveAborted, and counts each row
+	// tried as a node in options.stats. The matrix is left as it was built, ready for the next sudoku of the same shape.
+	int solve(Sudoku& s, const SolveOptions& options);
+
+	int boxWidth() const { return m_boxWidth; }
+	int boxHeight() const { return m_boxHeight; }
+
+private:
+	int m_size;
+	int m_boxWidth;
+	int m_boxHeight;
+	int m_numberOfColumns;
+
+	std::vector<int> m_left, m_right, m_up, m_down;
+	std::vector<int> m_column; // column header of each node
+	std::vector<int> m_candidate; // cell * size + digit - 1 of each node
+	std::vector<int> m_count; // number of nodes left in each column
+
+	// Scratch space for solve(), kept with the matrix so solving allocates nothing once it has been used
+	std::vector<int> m_values; // value of each cell
+	std::vector<int> m_givens; // row of each given
+	std::vector<char> m_covered; // columns covered by the givens
+	std::vector<int> m_first; // first solution found
+	std::vector<int> m_chosen; // node of the row chosen at each level of the search
+
+	void cover(int column);
+	void uncover(int column);
+	int chooseColumn() const;
+};
+
+// Solve with the exact cover engine, used by Solve() when options.engine is DancingLinksEngine
+int solveExactCover(Sudoku& s, const SolveOptions& options);
@@ -0,0 +1,238 @@
+#include "DigitCounts.h"
+
+#include <atomic>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DIGIT_COUNTS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only allow AVX2 intrinsics in functions marked as using it, MSVC allows them anywhere
+#if defined(DIGIT_COUNTS_X86) && !defined(_MSC_VER)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE2
+#endif
+
+// A digit seen by two cells, or by one cell from each half, is seen more than once
+static inline void combine(DigitCounts& counts, DigitMask seen, DigitMask multiple) {
+	counts.multiple |= multiple | (counts.seen & seen);
+	counts.seen |= seen;
+}
+
+static void countScalar(const DigitMask* t, const CellIndex* unit, int size, DigitCounts& counts) {
+	DigitMask seen = 0, multiple = 0;
+	for (int k = 0; k < size; k++) {
+		DigitMask possible = t[unit[k]];
+		multiple |= seen & possible;
+		seen |= possible;
+	}
+	counts.seen = seen;
+	counts.multiple = multiple;
+}
+
+static void countUnitsScalar(const DigitMask* t, const CellIndex* units, DigitMask which, int size, DigitCounts* counts) {
+	for (; which; which &= which - 1) {
+		int u = lowestBit(which);
+		countScalar(t, units + (size_t)u * size, size, counts[u]);
+	}
+}
+
+#ifdef DIGIT_COUNTS_X86
+
+// Two cells at a time, one in each 64 bit lane
+TARGET_SSE2 static void countSse2(const DigitMask* t, const CellIndex* unit, int size, DigitCounts& counts) {
+	__m128i seen = _mm_setzero_si128(), multiple = _mm_setzero_si128();
+	int k = 0;
+	for (; k + 2 <= size; k += 2) {
+		__m128i possible = _mm_set_epi64x((long long)t[unit[k + 1]], (long long)t[unit[k]]);
+		multiple = _mm_or_si128(multiple, _mm_and_si128(seen, possible));
+		seen = _mm_or_si128(seen, possible);
+	}
+
+	alignas(16) DigitMask s[2], m[2];
+	_mm_store_si128((__m128i*)s, seen);
+	_mm_store_si128((__m128i*)m, multiple);
+	counts.seen = s[0];
+	counts.multiple = m[0];
+	combine(counts, s[1], m[1]);
+	for (; k < size; k++) {
+		combine(counts, t[unit[k]], 0);
+	}
+}
+
+// Four cells at a time, gathered straight from the table using the unit's cell indices
+TARGET_AVX2 static void countAvx2(const DigitMask* t, const CellIndex* unit, int size, DigitCounts& counts) {
+	__m256i seen = _mm256_setzero_si256(), multiple = _mm256_setzero_si256();
+	int k = 0;
+	for (; k + 4 <= size; k += 4) {
+		__m128i index = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(unit + k)));
+		__m256i possible = _mm256_i32gather_epi64((const long long*)t, index, 8);
+		multiple = _mm256_or_si256(multiple, _mm256_and_si256(seen, possible));
+		seen = _mm256_or_si256(seen, possible);
+	}
+
+	// Fold the upper two lanes into the lower two
+	__m128i seenLow = _mm256_castsi256_si128(seen), seenHigh = _mm256_extracti128_si256(seen, 1);
+	__m128i multipleLow = _mm256_castsi256_si128(multiple), multipleHigh = _mm256_extracti128_si256(multiple, 1);
+	__m128i seen2 = _mm_or_si128(seenLow, seenHigh);
+	__m128i multiple2 = _mm_or_si128(_mm_or_si128(multipleLow, multipleHigh), _mm_and_si128(seenLow, seenHigh));
+
+	alignas(16) DigitMask s[2], m[2];
+	_mm_store_si128((__m128i*)s, seen2);
+	_mm_store_si128((__m128i*)m, multiple2);
+	counts.seen = s[0];
+	counts.multiple = m[0];
+	combine(counts, s[1], m[1]);
+	for (; k < size; k++) {
+		combine(counts, t[unit[k]], 0);
+	}
+}
+
+// Two units at a time, one in each 64 bit lane, and a unit left over on its own
+TARGET_SSE2 static void countUnitsSse2(const DigitMask* t, const CellIndex* units, DigitMask which, int size,
+	DigitCounts* counts) {
+	while (which) {
+		int first = lowestBit(which);
+		which &= which - 1;
+		if (!which) {
+			countSse2(t, units + (size_t)first * size, size, counts[first]);
+			break;
+		}
+		int second = lowestBit(which);
+		which &= which - 1;
+
+		const CellIndex* firstUnit = units + (size_t)first * size;
+		const CellIndex* secondUnit = units + (size_t)second * size;
+		__m128i seen = _mm_setzero_si128(), multiple = _mm_setzero_si128();
+		for (int k = 0; k < size; k++) {
+			__m128i possible = _mm_set_epi64x((long long)t[secondUnit[k]], (long long)t[firstUnit[k]]);
+			multiple = _mm_or_si128(multiple, _mm_and_si128(seen, possible));
+			seen = _mm_or_si128(seen, possible);
+		}
+
+		alignas(16) DigitMask s[2], m[2];
+		_mm_store_si128((__m128i*)s, seen);
+		_mm_store_si128((__m128i*)m, multiple);
+		counts[first].seen = s[0];
+		counts[first].multiple = m[0];
+		counts[second].seen = s[1];
+		counts[second].multiple = m[1];
+	}
+}
+
+// Four units at a time, one in each 64 bit lane, loading the k-th cell of each on every step. Building the index vector
+// for a gather costs more than the four loads. Up to three units left over are counted one at a time.
+TARGET_AVX2 static void countUnitsAvx2(const DigitMask* t, const CellIndex* units, DigitMask which, int size,
+	DigitCounts* counts) {
+	while (countDigits(which) >= 4) {
+		int u[4];
+		const CellIndex* unit[4];
+		for (int i = 0; i < 4; i++) {
+			u[i] = lowestBit(which);
+			which &= which - 1;
+			unit[i] = units + (size_t)u[i] * size;
+		}
+
+		__m256i seen = _mm256_setzero_si256(), multiple = _mm256_setzero_si256();
+		for (int k = 0; k < size; k++) {
+			__m256i possible = _mm256_set_epi64x((long long)t[unit[3][k]], (long long)t[unit[2][k]],
+				(long long)t[unit[1][k]], (long long)t[unit[0][k]]);
+			multiple = _mm256_or_si256(multiple, _mm256_and_si256(seen, possible));
+			seen = _mm256_or_si256(seen, possible);
+		}
+
+		alignas(32) DigitMask s[4], m[4];
+		_mm256_store_si256((__m256i*)s, seen);
+		_mm256_store_si256((__m256i*)m, multiple);
+		for (int i = 0; i < 4; i++) {
+			counts[u[i]].seen = s[i];
+			counts[u[i]].multiple = m[i];
+		}
+	}
+	for (; which; which &= which - 1) {
+		int u = lowestBit(which);
+		countAvx2(t, units + (size_t)u * size, size, counts[u]);
+	}
+}
+
+static SimdLevel detectSimdLevel() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int highest = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	// AVX registers are only usable if the operating system saves them
+	bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+	bool avx2 = false;
+	if (avx && highest >= 7) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool sse2 = __builtin_cpu_supports("sse2");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (avx2) return Avx2Level;
+	if (sse2) return Sse2Level;
+	return ScalarLevel;
+}
+
+#else
+
+static SimdLevel detectSimdLevel() {
+	return ScalarLevel;
+}
+
+#endif
+
+SimdLevel supportedSimdLevel() {
+	static const SimdLevel supported = detectSimdLevel();
+	return supported;
+}
+
+static std::atomic<int> selectedLevel(-1);
+
+SimdLevel simdLevel() {
+	int level = selectedLevel.load(std::memory_order_relaxed);
+	return level < 0 ? supportedSimdLevel() : (SimdLevel)level;
+}
+
+void setSimdLevel(SimdLevel level) {
+	if (level > supportedSimdLevel()) level = supportedSimdLevel();
+	selectedLevel = level;
+}
+
+const char* simdLevelName(SimdLevel level) {
+	switch (level) {
+	case Sse2Level: return "sse2";
+	case Avx2Level: return "avx2";
+	default: return "scalar";
+	}
+}
+
+DigitCountKernel digitCountKernel() {
+#ifdef DIGIT_COUNTS_X86
+	switch (simdLevel()) {
+	case Avx2Level: return countUnitsAvx2;
+	case Sse2Level: return countUnitsSse2;
+	default: break;
+	}
+#endif
+	return countUnitsScalar;
+}
+
+void countUnitDigits(const DigitMask* t, const CellIndex* units, int numberOfUnits, int size, DigitCounts* counts) {
+	DigitCountKernel count = digitCountKernel();
+	for (int u = 0; u < numberOfUnits; u += 64) {
+		int n = numberOfUnits - u < 64 ? numberOfUnits - u : 64;
+		count(t, units + (size_t)u * size, allDigits(n), size, counts + u);
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "DigitMask.h"
+#include "Geometry.h"
+
+// How many cells of a unit may still hold each digit, as far as the solver needs to know: none, exactly one or more.
+struct DigitCounts {
+	DigitMask seen; // digits possible in at least one cell
+	DigitMask multiple; // digits possible in at least two cells
+
+	DigitMask once() const { return seen & ~multiple; }
+	DigitMask none(DigitMask all) const { return all & ~seen; }
+};
+
+// Instruction sets the counting kernels can use. The best one the processor supports is picked the first time the
+// kernels are used.
+enum SimdLevel {
+	ScalarLevel,
+	Sse2Level,
+	Avx2Level
+};
+
+SimdLevel supportedSimdLevel();
+SimdLevel simdLevel();
+
+// Use a lower level than the processor supports, e.g. to compare them. Levels above the supported one are ignored.
+void setSimdLevel(SimdLevel level);
+
+const char* simdLevelName(SimdLevel level);
+
+// Count the digits of the units in which, bit u standing for the unit of size cells whose cell indices start at
+// units + u * size, using the possible digits t of every cell. counts[u] is filled in for each of them. The SIMD kernels
+// count several units at once, one in each lane, so they do best given many units in one call.
+typedef void (*DigitCountKernel)(const DigitMask* t, const CellIndex* units, DigitMask which, int size,
+	DigitCounts* counts);
+
+// The kernel for the current level. Look it up once, e.g. per solve, rather than for every count.
+DigitCountKernel digitCountKernel();
+
+// Count the digits of numberOfUnits units whose cell indices are stored one unit after another from units. counts gets
+// one entry per unit.
+void countUnitDigits(const DigitMask* t, const CellIndex* units, int numberOfUnits, int size, DigitCounts* counts);
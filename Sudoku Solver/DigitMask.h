@@ -0,0 +1,66 @@
+#pragma once
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// A set of digits packed into one machine word. Bit (d - 1) is set when digit d is in the set.
+// The same type is used for sets of cell positions within a box/row/column, where bit k is the k-th cell of the unit.
+typedef unsigned long long DigitMask;
+
+// Mask containing the digits 1 to n.
+inline DigitMask allDigits(int n) {
+	return n >= 64 ? ~0ULL : (1ULL << n) - 1;
+}
+
+inline DigitMask digitBit(int d) {
+	return 1ULL << (d - 1);
+}
+
+// Number of digits in the set
+inline int countDigits(DigitMask m) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	return (int)__popcnt64(m);
+#elif defined(_MSC_VER)
+	return (int)(__popcnt((unsigned int)m) + __popcnt((unsigned int)(m >> 32)));
+#else
+	return __builtin_popcountll(m);
+#endif
+}
+
+// Index of the lowest set bit. m must not be zero.
+inline int lowestBit(DigitMask m) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, m);
+	return (int)index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanForward(&index, (unsigned long)m)) return (int)index;
+	_BitScanForward(&index, (unsigned long)(m >> 32));
+	return (int)index + 32;
+#else
+	return __builtin_ctzll(m);
+#endif
+}
+
+// Index of the highest set bit. m must not be zero.
+inline int highestBit(DigitMask m) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanReverse64(&index, m);
+	return (int)index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanReverse(&index, (unsigned long)(m >> 32))) return (int)index + 32;
+	_BitScanReverse(&index, (unsigned long)m);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(m);
+#endif
+}
+
+// Smallest digit in the set. m must not be zero.
+inline int lowestDigit(DigitMask m) {
+	return lowestBit(m) + 1;
+}
@@ -0,0 +1,218 @@
+#include "Generator.h"
+#include "BatchSolver.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+PuzzleGenerator::PuzzleGenerator(const GeneratorOptions& options) {
+	m_options = options;
+	m_size = options.boxWidth * options.boxHeight;
+	m_grid.reshape(options.boxWidth, options.boxHeight);
+	m_check.reshape(options.boxWidth, options.boxHeight);
+	m_best.reshape(options.boxWidth, options.boxHeight);
+	m_permutation.resize(m_size);
+	m_uniqueness.mode = ProveUnique;
+	m_uniqueness.nodeLimit = options.checkNodeLimit;
+}
+
+// The cell removed together with this one, itself when there is no symmetry or the cell is on the axis
+int PuzzleGenerator::partner(int cell) const {
+	int x = cell / m_size;
+	int y = cell % m_size;
+	switch (m_options.symmetry) {
+	case RotationalSymmetry: return (m_size - 1 - x) * m_size + (m_size - 1 - y);
+	case MirrorSymmetry: return (m_size - 1 - x) * m_size + y;
+	default: return cell;
+	}
+}
+
+void PuzzleGenerator::shuffle(SplitMix64& random, int* values, int count) {
+	for (int i = count - 1; i > 0; i--) {
+		int j = random.below(i + 1);
+		int swap = values[i];
+		values[i] = values[j];
+		values[j] = swap;
+	}
+}
+
+void PuzzleGenerator::randomGrid(SplitMix64& random) {
+	int boxWidth = m_options.boxWidth;
+	int boxHeight = m_options.boxHeight;
+
+	// Any arrangement of the digits in one box can be completed, so the first solution the solver finds will do
+	for (int d = 0; d < m_size; d++) {
+		m_permutation[d] = d + 1;
+	}
+	shuffle(random, m_permutation.data(), m_size);
+	m_check.reshape(boxWidth, boxHeight);
+	for (int k = 0; k < m_size; k++) {
+		m_check.at(k / boxHeight, k % boxHeight) = (CellValue)m_permutation[k];
+	}
+	SolveOptions fill;
+	fill.mode = FindAny;
+	Solve(m_check, fill);
+
+	// The solver always completes the box the same way, so relabel the digits and shuffle the rows within each band of
+	// boxes, the bands, the columns within each stack of boxes and the stacks. None of these can break a rule.
+	int rows[64], columns[64], bands[64], stacks[64], inner[64];
+	for (int i = 0; i < boxWidth; i++) {
+		bands[i] = i;
+	}
+	shuffle(random, bands, boxWidth);
+	for (int b = 0; b < boxWidth; b++) {
+		for (int j = 0; j < boxHeight; j++) {
+			inner[j] = j;
+		}
+		shuffle(random, inner, boxHeight);
+		for (int j = 0; j < boxHeight; j++) {
+			rows[b * boxHeight + j] = bands[b] * boxHeight + inner[j];
+		}
+	}
+	for (int i = 0; i < boxHeight; i++) {
+		stacks[i] = i;
+	}
+	shuffle(random, stacks, boxHeight);
+	for (int s = 0; s < boxHeight; s++) {
+		for (int j = 0; j < boxWidth; j++) {
+			inner[j] = j;
+		}
+		shuffle(random, inner, boxWidth);
+		for (int j = 0; j < boxWidth; j++) {
+			columns[s * boxWidth + j] = stacks[s] * boxWidth + inner[j];
+		}
+	}
+	shuffle(random, m_permutation.data(), m_size);
+
+	for (int x = 0; x < m_size; x++) {
+		for (int y = 0; y < m_size; y++) {
+			m_grid.at(x, y) = (CellValue)m_permutation[m_check.at(columns[x], rows[y]) - 1];
+		}
+	}
+}
+
+// Take out as many groups of clues from m_grid as possible, down to the target, leaving a unique solution. Returns the
+// number of clues left.
+int PuzzleGenerator::removeClues(SplitMix64& random) {
+	// Each group is listed by its lowest cell. The list is rebuilt every time so the order only depends on random.
+	m_groups.clear();
+	for (int cell = 0; cell < m_size * m_size; cell++) {
+		if (partner(cell) >= cell) m_groups.push_back(cell);
+	}
+	shuffle(random, m_groups.data(), (int)m_groups.size());
+
+	int clues = m_size * m_size;
+	for (int cell : m_groups) {
+		if (m_options.targetClues > 0 && clues <= m_options.targetClues) break;
+		int other = partner(cell);
+		CellValue value = m_grid[cell];
+		CellValue otherValue = m_grid[other];
+		m_grid[cell] = -1;
+		m_grid[other] = -1;
+
+		// Copy assignment reuses the buffer, so checking allocates nothing. A check that gives up hasn't shown the puzzle
+		// is still unique, so the clues go back as they would for a second solution.
+		m_check = m_grid;
+		if (Solve(m_check, m_uniqueness) == 1) {
+			clues -= other == cell ? 1 : 2;
+		}
+		else {
+			m_grid[cell] = value;
+			m_grid[other] = otherValue;
+		}
+	}
+	return clues;
+}
+
+int PuzzleGenerator::generate(unsigned long long index, Sudoku& puzzle, Sudoku* solution) {
+	// Every puzzle has its own stream of random numbers, so puzzles don't depend on which thread made which
+	SplitMix64 random(SplitMix64(m_options.seed).next() ^ (index * 0xD1B54A32D192ED03ULL));
+
+	int fewest = -1;
+	int attempts = m_options.attempts > 0 ? m_options.attempts : 1;
+	for (int attempt = 0; attempt < attempts; attempt++) {
+		randomGrid(random);
+		if (solution) m_solution = m_grid;
+		int clues = removeClues(random);
+		if (fewest < 0 || clues < fewest) {
+			// m_grid is made again from scratch for the next attempt, so it can just swap buffers with the best puzzle
+			fewest = clues;
+			std::swap(m_best, m_grid);
+			if (solution) *solution = m_solution;
+		}
+		if (m_options.targetClues <= 0 || fewest <= m_options.targetClues) break;
+	}
+	puzzle = m_best;
+	return fewest;
+}
+
+void generatePuzzles(const GeneratorOptions& options, unsigned long long count, int threads, const PuzzleCallback& done) {
+	if (threads <= 0) threads = defaultBatchThreads();
+
+	if (threads == 1) {
+		PuzzleGenerator generator(options);
+		Sudoku puzzle;
+		for (unsigned long long i = 0; i < count; i++) {
+			int clues = generator.generate(i, puzzle);
+			done(i, puzzle, clues);
+		}
+		return;
+	}
+
+	// Puzzle i is made in slot i % window and handed back in order by the calling thread, workers wait while the window is
+	// full of puzzles not yet handed back
+	size_t window = defaultBatchWindow(threads);
+	std::unique_ptr<Sudoku[]> puzzles(new Sudoku[window]);
+	std::unique_ptr<int[]> clues(new int[window]);
+	std::unique_ptr<bool[]> ready(new bool[window]());
+	std::mutex lock;
+	std::condition_variable readySignal, spaceSignal;
+	unsigned long long nextIndex = 0, nextOut = 0;
+
+	auto work = [&]() {
+		PuzzleGenerator generator(options);
+		Sudoku puzzle;
+		while (true) {
+			unsigned long long i;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				spaceSignal.wait(guard, [&] { return nextIndex >= count || nextIndex - nextOut < window; });
+				if (nextIndex >= count) return;
+				i = nextIndex++;
+			}
+			int n = generator.generate(i, puzzle);
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				size_t slot = (size_t)(i % window);
+				std::swap(puzzles[slot], puzzle);
+				clues[slot] = n;
+				ready[slot] = true;
+			}
+			readySignal.notify_one();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++) {
+		workers.emplace_back(work);
+	}
+	while (nextOut < count) {
+		size_t slot = (size_t)(nextOut % window);
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			readySignal.wait(guard, [&] { return ready[slot]; });
+			ready[slot] = false;
+		}
+		done(nextOut, puzzles[slot], clues[slot]);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			nextOut++;
+		}
+		spaceSignal.notify_all();
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
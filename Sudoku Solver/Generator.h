@@ -0,0 +1,94 @@
+#pragma once
+#include <functional>
+#include <vector>
+
+#include "Solver.h"
+#include "Sudoku.h"
+
+// Which cells are removed together while taking clues out, so the clues of the finished puzzle form a pattern
+enum ClueSymmetry {
+	NoSymmetry,
+	RotationalSymmetry, // a clue at (x, y) has another at (size - 1 - x, size - 1 - y)
+	MirrorSymmetry // a clue at (x, y) has another at (size - 1 - x, y)
+};
+
+struct GeneratorOptions {
+	int boxWidth;
+	int boxHeight;
+	int targetClues; // stop taking clues out once this few are left, 0 takes out as many as possible
+	int attempts; // complete grids tried for each puzzle to get down to targetClues, the puzzle with fewest clues is kept
+	ClueSymmetry symmetry;
+	unsigned long long seed; // the same seed always gives the same puzzles, whatever the number of threads
+	long long checkNodeLimit; // guesses a uniqueness check can make before giving up and keeping the clue, 0 for no limit
+
+	GeneratorOptions() {
+		boxWidth = 3;
+		boxHeight = 3;
+		targetClues = 0;
+		attempts = 1;
+		symmetry = RotationalSymmetry;
+		seed = 1;
+		checkNodeLimit = 200;
+	}
+};
+
+// Small, fast random numbers. Written out here rather than taken from <random> so the same seed gives the same puzzles
+// with every standard library.
+class SplitMix64 {
+public:
+	SplitMix64(unsigned long long seed) {
+		m_state = seed;
+	}
+
+	unsigned long long next() {
+		unsigned long long z = (m_state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	// Uniform in 0 to n - 1
+	int below(int n) {
+		return (int)(next() % (unsigned long long)n);
+	}
+
+private:
+	unsigned long long m_state;
+};
+
+// Makes puzzles with exactly one solution. A random complete grid is made by solving a grid whose first box holds a
+// random permutation of the digits and then shuffling its digits, rows and columns. Clues are then taken out a group of
+// cells at a time (one cell, or the cells the symmetry pairs up) in random order, putting a group back whenever the
+// puzzle stops having a unique solution.
+//
+// A generator holds the scratch grids for one thread, so making puzzles allocates nothing once the first has been made.
+class PuzzleGenerator {
+public:
+	PuzzleGenerator(const GeneratorOptions& options);
+
+	// Make puzzle number index of the sequence options.seed gives, and its solution if solution isn't NULL. Returns the
+	// number of clues.
+	int generate(unsigned long long index, Sudoku& puzzle, Sudoku* solution = NULL);
+
+private:
+	GeneratorOptions m_options;
+	int m_size;
+	Sudoku m_grid; // complete grid being made into a puzzle
+	Sudoku m_check; // copy solved to check a puzzle is still unique
+	Sudoku m_best; // puzzle with the fewest clues so far
+	Sudoku m_solution; // complete grid the latest attempt started from
+	std::vector<int> m_groups; // first cell of each group of cells taken out together
+	std::vector<int> m_permutation;
+	SolveOptions m_uniqueness;
+
+	void randomGrid(SplitMix64& random);
+	int removeClues(SplitMix64& random);
+	int partner(int cell) const;
+	void shuffle(SplitMix64& random, int* values, int count);
+};
+
+// Called with each puzzle in index order, on the thread that called generatePuzzles
+typedef std::function<void(unsigned long long index, const Sudoku& puzzle, int clues)> PuzzleCallback;
+
+// Make puzzles 0 to count - 1 of the sequence options.seed gives, on threads threads (0 for one per core).
+void generatePuzzles(const GeneratorOptions& options, unsigned long long count, int threads, const PuzzleCallback& done);
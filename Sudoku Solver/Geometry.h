@@ -0,0 +1,209 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "DigitMask.h"
+
+// Cells are numbered x * size + y, the same order Sudoku stores its cells in.
+// Units are numbered with the boxes first, then the rows and then the columns. Box a * boxWidth + b holds the cells
+// a * boxWidth <= x < (a + 1) * boxWidth and b * boxHeight <= y < (b + 1) * boxHeight, listed with x in the outer loop.
+// Row y lists its cells by x and column x lists its cells by y.
+typedef unsigned short CellIndex;
+
+// Cells sharing a box, row or column with a cell, not counting the cell itself
+constexpr int numberOfPeers(int boxWidth, int boxHeight) {
+	return 2 * (boxWidth * boxHeight - 1) + (boxWidth - 1) * (boxHeight - 1);
+}
+
+constexpr void fillUnits(int boxWidth, int boxHeight, CellIndex* units) {
+	int size = boxWidth * boxHeight;
+	for (int u = 0; u < size; u++) {
+		int k = 0;
+		for (int x = (u / boxWidth) * boxWidth; x < (u / boxWidth + 1) * boxWidth; x++) {
+			for (int y = (u % boxWidth) * boxHeight; y < (u % boxWidth + 1) * boxHeight; y++) {
+				units[u * size + k++] = (CellIndex)(x * size + y);
+			}
+		}
+	}
+	for (int i = 0; i < size; i++) {
+		for (int k = 0; k < size; k++) {
+			units[(size + i) * size + k] = (CellIndex)(k * size + i);
+			units[(2 * size + i) * size + k] = (CellIndex)(i * size + k);
+		}
+	}
+}
+
+constexpr void fillBoxes(int boxWidth, int boxHeight, CellIndex* boxes) {
+	int size = boxWidth * boxHeight;
+	for (int x = 0; x < size; x++) {
+		for (int y = 0; y < size; y++) {
+			boxes[x * size + y] = (CellIndex)((x / boxWidth) * boxWidth + y / boxHeight);
+		}
+	}
+}
+
+// Where each cell comes in the list of cells of its box
+constexpr void fillBoxPositions(int boxWidth, int boxHeight, CellIndex* positions) {
+	int size = boxWidth * boxHeight;
+	for (int x = 0; x < size; x++) {
+		for (int y = 0; y < size; y++) {
+			positions[x * size + y] = (CellIndex)((x % boxWidth) * boxHeight + y % boxHeight);
+		}
+	}
+}
+
+// The cells a box shares with a row or column that crosses it, seen from one of the two units. cells are the positions of
+// the shared cells in the unit the table belongs to and otherCells their positions in the crossing unit.
+struct Intersection {
+	int other;
+	DigitMask cells;
+	DigitMask otherCells;
+};
+
+// Every unit crosses at most boxWidth + boxHeight others: a box crosses boxHeight rows and boxWidth columns, a row crosses
+// boxHeight boxes and a column boxWidth boxes. Unit u's intersections start at (boxWidth + boxHeight) * u.
+constexpr void fillIntersections(int boxWidth, int boxHeight, Intersection* intersections) {
+	int size = boxWidth * boxHeight;
+	int stride = boxWidth + boxHeight;
+	for (int u = 0; u < size; u++) {
+		int startX = (u / boxWidth) * boxWidth;
+		int startY = (u % boxWidth) * boxHeight;
+		int i = 0;
+		for (int j = 0; j < boxHeight; j++) {
+			// Row startY + j has cells (x % boxWidth) * boxHeight + j of the box
+			Intersection& box = intersections[u * stride + i++];
+			Intersection& row = intersections[(size + startY + j) * stride + u / boxWidth];
+			box.other = size + startY + j;
+			row.other = u;
+			for (int a = 0; a < boxWidth; a++) {
+				box.cells |= 1ULL << (a * boxHeight + j);
+				box.otherCells |= 1ULL << (startX + a);
+			}
+			row.cells = box.otherCells;
+			row.otherCells = box.cells;
+		}
+		for (int a = 0; a < boxWidth; a++) {
+			// Column startX + a has cells a * boxHeight to a * boxHeight + boxHeight - 1 of the box
+			Intersection& box = intersections[u * stride + i++];
+			Intersection& column = intersections[(2 * size + startX + a) * stride + u % boxWidth];
+			box.other = 2 * size + startX + a;
+			column.other = u;
+			for (int j = 0; j < boxHeight; j++) {
+				box.cells |= 1ULL << (a * boxHeight + j);
+				box.otherCells |= 1ULL << (startY + j);
+			}
+			column.cells = box.otherCells;
+			column.otherCells = box.cells;
+		}
+	}
+}
+
+constexpr int numberOfIntersections(int boxWidth, int boxHeight, int u) {
+	int size = boxWidth * boxHeight;
+	return u < size ? boxWidth + boxHeight : u < 2 * size ? boxHeight : boxWidth;
+}
+
+// Peers of each cell: its row, then its column, then the rest of its box.
+constexpr void fillPeers(int boxWidth, int boxHeight, CellIndex* peers) {
+	int size = boxWidth * boxHeight;
+	int p = 0;
+	for (int x = 0; x < size; x++) {
+		for (int y = 0; y < size; y++) {
+			for (int a = 0; a < size; a++) {
+				if (a != x) peers[p++] = (CellIndex)(a * size + y);
+			}
+			for (int b = 0; b < size; b++) {
+				if (b != y) peers[p++] = (CellIndex)(x * size + b);
+			}
+			int startX = x / boxWidth * boxWidth;
+			int startY = y / boxHeight * boxHeight;
+			for (int a = startX; a < startX + boxWidth; a++) {
+				for (int b = startY; b < startY + boxHeight; b++) {
+					if (a != x && b != y) peers[p++] = (CellIndex)(a * size + b);
+				}
+			}
+		}
+	}
+}
+
+// Shape of a sudoku known at compile time. The lookup tables are built by the compiler so the solver never has to divide
+// by the box size or search for a cell's neighbours.
+template <int BW, int BH>
+struct Geometry {
+	static constexpr int boxWidth = BW;
+	static constexpr int boxHeight = BH;
+	static constexpr int size = BW * BH;
+	static constexpr int cells = size * size;
+	static constexpr int peerCount = numberOfPeers(BW, BH);
+
+	struct Tables {
+		CellIndex units[3 * size * size];
+		CellIndex boxes[cells];
+		CellIndex boxPositions[cells];
+		CellIndex peers[cells * peerCount];
+		Intersection intersections[3 * size * (BW + BH)];
+	};
+
+	static constexpr Tables buildTables() {
+		Tables tables{};
+		fillUnits(BW, BH, tables.units);
+		fillBoxes(BW, BH, tables.boxes);
+		fillBoxPositions(BW, BH, tables.boxPositions);
+		fillPeers(BW, BH, tables.peers);
+		fillIntersections(BW, BH, tables.intersections);
+		return tables;
+	}
+
+	static constexpr Tables tables = buildTables();
+
+	const CellIndex* unit(int u) const { return tables.units + u * size; }
+	const CellIndex* peers(int cell) const { return tables.peers + cell * peerCount; }
+	int box(int cell) const { return tables.boxes[cell]; }
+	int boxPosition(int cell) const { return tables.boxPositions[cell]; }
+	const Intersection* intersections(int u) const { return tables.intersections + u * (BW + BH); }
+	int intersectionCount(int u) const { return numberOfIntersections(BW, BH, u); }
+};
+
+// Shape of a sudoku only known at runtime, with the same lookups as the fixed shapes.
+template <>
+struct Geometry<0, 0> {
+	int boxWidth;
+	int boxHeight;
+	int size;
+	int cells;
+	int peerCount;
+
+	std::vector<CellIndex> unitTable;
+	std::vector<CellIndex> boxTable;
+	std::vector<CellIndex> boxPositionTable;
+	std::vector<CellIndex> peerTable;
+	std::vector<Intersection> intersectionTable;
+
+	Geometry(int bW, int bH) {
+		boxWidth = bW;
+		boxHeight = bH;
+		size = bW * bH;
+		cells = size * size;
+		peerCount = numberOfPeers(bW, bH);
+
+		unitTable.resize((size_t)3 * size * size);
+		boxTable.resize(cells);
+		boxPositionTable.resize(cells);
+		peerTable.resize((size_t)cells * peerCount);
+		fillUnits(bW, bH, unitTable.data());
+		fillBoxes(bW, bH, boxTable.data());
+		fillBoxPositions(bW, bH, boxPositionTable.data());
+		fillPeers(bW, bH, peerTable.data());
+		intersectionTable.assign((size_t)3 * size * (bW + bH), Intersection());
+		fillIntersections(bW, bH, intersectionTable.data());
+	}
+
+	const CellIndex* unit(int u) const { return &unitTable[(size_t)u * size]; }
+	const CellIndex* peers(int cell) const { return &peerTable[(size_t)cell * peerCount]; }
+	int box(int cell) const { return boxTable[cell]; }
+	int boxPosition(int cell) const { return boxPositionTable[cell]; }
+	const Intersection* intersections(int u) const { return &intersectionTable[(size_t)u * (boxWidth + boxHeight)]; }
+	int intersectionCount(int u) const { return numberOfIntersections(boxWidth, boxHeight, u); }
+};
+
+typedef Geometry<0, 0> RuntimeGeometry;
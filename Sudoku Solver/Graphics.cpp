@@ -82,7 +82,7 @@ void Graphics::createResources()
 			DWRITE_FONT_WEIGHT_NORMAL,
 			DWRITE_FONT_STYLE_NORMAL,
 			DWRITE_FONT_STRETCH_NORMAL,
-			size.height / SUDOKU_SIZE / 2 * 96.0f / 72.0f,
+			size.height / grid->size / 2 * 96.0f / 72.0f,
 			L"en-US",
 			&pText
 		);
@@ -122,7 +122,7 @@ void Graphics::drawSudoku(const Sudoku& s) const{
 
 	for (int x = 0; x < s.size; x++) {
 		for (int y = 0; y < s.size; y++) {
-			int& cell = s.grid[x][y];
+			int cell = s.at(x, y);
 			if (cell != -1) {
 				if (cell == -2) {
 					//Fill cell black (or dark grey so gridlines remain visible)
@@ -130,7 +130,7 @@ void Graphics::drawSudoku(const Sudoku& s) const{
 						D2D1::RectF(xOffset + x * columnWidth, yOffset + y * rowHeight, xOffset + (x + 1) * columnWidth, yOffset + (y + 1) * rowHeight),
 						pGrey);
 				}
-				else if (cell < SUDOKU_SIZE + 1) {
+				else if (cell <= s.size) {
 					// Draw the correct digit into the cell in colour 1
 
 					std::wstring text = std::to_wstring(cell);
@@ -145,7 +145,7 @@ void Graphics::drawSudoku(const Sudoku& s) const{
 				}
 				else {
 					// Draw the correct digit into the cell in colour 2
-					std::wstring text = std::to_wstring(cell - SUDOKU_SIZE - 1);
+					std::wstring text = std::to_wstring(cell - s.size - 1);
 
 					pRenderTarget->DrawText(
 						text.c_str(),
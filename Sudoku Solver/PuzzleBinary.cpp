@@ -0,0 +1,248 @@
+#include "PuzzleBinary.h"
+#include "Solver.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const unsigned char magic[4] = { 'S', 'U', 'D', 'K' };
+static const int binaryVersion = 1;
+
+BinaryLayout::BinaryLayout(BinaryKind k, int bW, int bH) {
+	kind = k;
+	boxWidth = bW;
+	boxHeight = bH;
+	int size = bW * bH;
+	bitsPerCell = 1;
+	while ((1 << bitsPerCell) <= size) bitsPerCell++;
+	recordSize = ((size_t)size * size * bitsPerCell + 7) / 8 + (k == BinaryResults ? 1 : 0);
+}
+
+void writeBinaryHeader(const BinaryLayout& layout, unsigned char* out) {
+	memset(out, 0, BinaryHeaderSize);
+	memcpy(out, magic, sizeof(magic));
+	out[4] = (unsigned char)binaryVersion;
+	out[5] = (unsigned char)layout.kind;
+	out[6] = (unsigned char)layout.boxWidth;
+	out[7] = (unsigned char)layout.boxHeight;
+	out[8] = (unsigned char)layout.bitsPerCell;
+	for (int i = 0; i < 4; i++) out[12 + i] = (unsigned char)(layout.recordSize >> (8 * i));
+}
+
+bool readBinaryHeader(const unsigned char* data, size_t length, BinaryLayout& layout) {
+	if (length < BinaryHeaderSize || memcmp(data, magic, sizeof(magic)) != 0 || data[4] != binaryVersion) return false;
+	if (data[5] != BinaryPuzzles && data[5] != BinaryResults) return false;
+	int boxWidth = data[6], boxHeight = data[7];
+	if (boxWidth < 1 || boxHeight < 1 || boxWidth * boxHeight > MaxSudokuSize) return false;
+
+	// Everything else follows from the kind and box shape, so it only has to agree
+	layout = BinaryLayout((BinaryKind)data[5], boxWidth, boxHeight);
+	size_t recordSize = 0;
+	for (int i = 0; i < 4; i++) recordSize |= (size_t)data[12 + i] << (8 * i);
+	return data[8] == layout.bitsPerCell && recordSize == layout.recordSize;
+}
+
+void packGrid(const Sudoku& s, const BinaryLayout& layout, unsigned char* record) {
+	int size = s.size;
+	const CellValue* grid = s.all().data;
+	int bits = layout.bitsPerCell;
+	uint64_t buffer = 0;
+	int filled = 0;
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			int value = grid[x * size + y];
+			buffer |= (uint64_t)(value > 0 ? value : 0) << filled;
+			filled += bits;
+			while (filled >= 8) {
+				*record++ = (unsigned char)buffer;
+				buffer >>= 8;
+				filled -= 8;
+			}
+		}
+	}
+	if (filled > 0) *record = (unsigned char)buffer;
+}
+
+bool unpackGrid(const unsigned char* record, const BinaryLayout& layout, Sudoku& s) {
+	// The record is decoded row by row into a buffer first and then turned into the column by column order of s, which
+	// keeps both loops simple enough for the compiler to do well with
+	CellValue rows[64 * 64 + 1];
+	int size = s.size;
+	int cells = size * size;
+	int bits = layout.bitsPerCell;
+	int mask = (1 << bits) - 1;
+	int tooBig = 0; // negative once a value above size is seen
+
+	if (bits == 4) {
+		// Two cells a byte, the common case of 9x9
+		for (int i = 0; i < cells; i += 2) {
+			int low = *record & mask, high = *record++ >> 4;
+			tooBig |= (size - low) | (size - high);
+			rows[i] = (CellValue)(low > 0 ? low : -1);
+			rows[i + 1] = (CellValue)(high > 0 ? high : -1);
+		}
+	}
+	else {
+		const unsigned char* end = record + ((size_t)cells * bits + 7) / 8;
+		uint64_t buffer = 0;
+		int filled = 0;
+		for (int i = 0; i < cells; i++) {
+			if (filled < bits) {
+				// Top up with as many whole bytes as fit, a cell is at most 7 bits
+				while (filled <= 56 && record < end) {
+					buffer |= (uint64_t)*record++ << filled;
+					filled += 8;
+				}
+			}
+			int value = (int)buffer & mask;
+			buffer >>= bits;
+			filled -= bits;
+			tooBig |= size - value;
+			rows[i] = (CellValue)(value > 0 ? value : -1);
+		}
+	}
+
+	CellValue* grid = s.all().data;
+	for (int x = 0; x < size; x++) {
+		for (int y = 0; y < size; y++) {
+			grid[x * size + y] = rows[y * size + x];
+		}
+	}
+	return tooBig >= 0;
+}
+
+void packResult(const Sudoku& s, int status, const BinaryLayout& layout, unsigned char* record) {
+	if (status == SolveAborted) status = BinaryAborted;
+	else if (status != BinaryInvalid && status > 253) status = 253;
+	record[0] = (unsigned char)status;
+	packGrid(s, layout, record + 1);
+}
+
+bool unpackResult(const unsigned char* record, const BinaryLayout& layout, Sudoku& s, int& status) {
+	status = record[0] == BinaryAborted ? SolveAborted : record[0];
+	return unpackGrid(record + 1, layout, s);
+}
+
+MappedFile::MappedFile() {
+	m_data = NULL;
+	m_size = 0;
+	m_mapping = NULL;
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const char* path) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return false;
+	bool mapped = open(file);
+	fclose(file);
+	return mapped;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(FILE* file) {
+	close();
+	HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+	LARGE_INTEGER size;
+	if (handle == INVALID_HANDLE_VALUE || GetFileType(handle) != FILE_TYPE_DISK || !GetFileSizeEx(handle, &size)) return false;
+	if (size.QuadPart == 0) return true;
+
+	HANDLE mapping = CreateFileMappingW(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) return false;
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) {
+		CloseHandle(mapping);
+		return false;
+	}
+	m_mapping = mapping;
+	m_data = (const unsigned char*)view;
+	m_size = (size_t)size.QuadPart;
+	return true;
+}
+
+void MappedFile::close() {
+	if (m_data != NULL) UnmapViewOfFile(m_data);
+	if (m_mapping != NULL) CloseHandle((HANDLE)m_mapping);
+	m_data = NULL;
+	m_size = 0;
+	m_mapping = NULL;
+}
+
+#else
+
+bool MappedFile::open(FILE* file) {
+	close();
+	int fd = fileno(file);
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) return false;
+	if (info.st_size == 0) return true;
+
+	void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED) return false;
+	// Records are read front to back, so the kernel can read well ahead
+	madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+	m_data = (const unsigned char*)view;
+	m_size = (size_t)info.st_size;
+	return true;
+}
+
+void MappedFile::close() {
+	if (m_data != NULL) munmap((void*)m_data, m_size);
+	m_data = NULL;
+	m_size = 0;
+}
+
+#endif
+
+BinaryFile::BinaryFile() : m_layout(BinaryPuzzles, 3, 3) {
+	m_records = NULL;
+	m_count = 0;
+}
+
+bool BinaryFile::open(const char* path, const char*& error) {
+	error = NULL;
+	if (!m_file.open(path)) return false;
+	return check(error);
+}
+
+bool BinaryFile::open(FILE* file, const char*& error) {
+	error = NULL;
+	if (!m_file.open(file)) return false;
+	return check(error);
+}
+
+bool BinaryFile::check(const char*& error) {
+	m_records = NULL;
+	m_count = 0;
+	if (!readBinaryHeader(m_file.data(), m_file.size(), m_layout)) {
+		if (m_file.size() >= sizeof(magic) && memcmp(m_file.data(), magic, sizeof(magic)) == 0) {
+			error = "has a header this version can't read";
+		}
+		m_file.close();
+		return false;
+	}
+	size_t length = m_file.size() - BinaryHeaderSize;
+	if (length % m_layout.recordSize != 0) {
+		error = "ends part way through a record";
+		m_file.close();
+		return false;
+	}
+	m_records = m_file.data() + BinaryHeaderSize;
+	m_count = length / m_layout.recordSize;
+	return true;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include "Sudoku.h"
+
+// Packed binary files of puzzles or of results, for corpora too big to read as text quickly.
+//
+// A file is a 16 byte header followed by fixed size records, all for the same box shape:
+//
+//   bytes 0-3    "SUDK"
+//   byte 4       version, 1
+//   byte 5       'P' for puzzles, 'S' for results
+//   bytes 6-7    box width and height
+//   byte 8       bits per cell, the fewest that hold 0 to size: 4 for 9x9, 5 for 16x16 and 25x25, 7 for 64x64
+//   bytes 9-11   0
+//   bytes 12-15  size of a record in bytes, little endian
+//
+// A puzzle record lists the cells row by row from the top left, as the text format does, each cell the digit or 0 for a
+// blank cell, packed from the lowest bit of the first byte up. A 9x9 puzzle takes 41 bytes. A result record is a status
+// byte, the number of solutions (253 standing for 253 or more), 254 for a search that gave up or 255 for a puzzle that
+// wasn't valid, followed by the grid packed the same way: the solution found, or the puzzle itself if there wasn't one.
+
+enum BinaryKind {
+	BinaryPuzzles = 'P',
+	BinaryResults = 'S'
+};
+
+const size_t BinaryHeaderSize = 16;
+
+// Status bytes of a result for a search that gave up (SolveAborted) and a puzzle that couldn't be read
+const int BinaryAborted = 254;
+const int BinaryInvalid = 255;
+
+// Where the records of one box shape and kind go
+struct BinaryLayout {
+	BinaryKind kind;
+	int boxWidth, boxHeight;
+	int bitsPerCell;
+	size_t recordSize;
+
+	BinaryLayout(BinaryKind k, int bW, int bH);
+};
+
+// Write the header for layout. out must have room for BinaryHeaderSize bytes.
+void writeBinaryHeader(const BinaryLayout& layout, unsigned char* out);
+
+// Read a header. Returns false if the bytes don't start a file of this format and version, or describe a box shape or
+// record size that doesn't add up.
+bool readBinaryHeader(const unsigned char* data, size_t length, BinaryLayout& layout);
+
+// Pack the cells of s, which must have the layout's shape. Black cells are written as blank ones.
+void packGrid(const Sudoku& s, const BinaryLayout& layout, unsigned char* record);
+
+// Unpack the cells of a record into s, which must have the layout's shape. Returns false if a cell holds a value above
+// size.
+bool unpackGrid(const unsigned char* record, const BinaryLayout& layout, Sudoku& s);
+
+// Pack a result: status is the number of solutions, SolveAborted or BinaryInvalid
+void packResult(const Sudoku& s, int status, const BinaryLayout& layout, unsigned char* record);
+
+// Unpack a result into s and status, which is SolveAborted for a search that gave up. Returns false if the grid holds a
+// value above size.
+bool unpackResult(const unsigned char* record, const BinaryLayout& layout, Sudoku& s, int& status);
+
+// A whole file mapped into memory read only, so records are decoded straight from the page cache without being copied
+// into a buffer first.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Map the file at path, or an open file. The file can be closed once it is mapped. Returns false if it couldn't be
+	// mapped, e.g. it is a pipe. An empty file maps to no data.
+	bool open(const char* path);
+	bool open(FILE* file);
+	void close();
+
+	const unsigned char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	const unsigned char* m_data;
+	size_t m_size;
+	void* m_mapping; // handle of the mapping on Windows
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Records of a mapped binary file
+class BinaryFile {
+public:
+	BinaryFile();
+
+	// Map a file and check its header. Returns false with error NULL if the file can't be mapped or doesn't start like a
+	// binary file, so it can be read some other way, or with error saying what is wrong with a binary file.
+	bool open(const char* path, const char*& error);
+	bool open(FILE* file, const char*& error);
+
+	const BinaryLayout& layout() const { return m_layout; }
+	size_t count() const { return m_count; }
+	const unsigned char* record(size_t i) const { return m_records + i * m_layout.recordSize; }
+
+private:
+	MappedFile m_file;
+	BinaryLayout m_layout;
+	const unsigned char* m_records;
+	size_t m_count;
+
+	bool check(const char*& error);
+};
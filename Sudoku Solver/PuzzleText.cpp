@@ -0,0 +1,172 @@
+#include "PuzzleText.h"
+
+#include <cstring>
+
+// Value of every character in one encoding, 0 for a blank cell and -1 for a character that can't appear in a puzzle.
+struct DecodeTable {
+	signed char value[256];
+};
+
+static DecodeTable makeDecodeTable(CellEncoding encoding) {
+	DecodeTable table;
+	memset(table.value, -1, sizeof(table.value));
+	table.value[(unsigned char)'.'] = 0;
+
+	switch (encoding) {
+	case DigitEncoding:
+		table.value[(unsigned char)'0'] = 0;
+		for (int d = 1; d <= 9; d++) table.value['0' + d] = (signed char)d;
+		for (int d = 10; d < 10 + 26; d++) {
+			table.value['A' + d - 10] = (signed char)d;
+			table.value['a' + d - 10] = (signed char)d;
+		}
+		break;
+	case HexEncoding:
+		for (int d = 1; d <= 10; d++) table.value['0' + d - 1] = (signed char)d;
+		for (int d = 11; d <= 16; d++) {
+			table.value['A' + d - 11] = (signed char)d;
+			table.value['a' + d - 11] = (signed char)d;
+		}
+		break;
+	case AlphabeticEncoding:
+		table.value[(unsigned char)'0'] = 0;
+		for (int d = 1; d <= 26; d++) {
+			table.value['A' + d - 1] = (signed char)d;
+			table.value['a' + d - 1] = (signed char)d;
+		}
+		break;
+	}
+	return table;
+}
+
+static const DecodeTable& decodeTable(CellEncoding encoding) {
+	static const DecodeTable tables[3] = {
+		makeDecodeTable(DigitEncoding),
+		makeDecodeTable(HexEncoding),
+		makeDecodeTable(AlphabeticEncoding)
+	};
+	return tables[encoding];
+}
+
+int largestDigit(CellEncoding encoding) {
+	switch (encoding) {
+	case HexEncoding: return 16;
+	case AlphabeticEncoding: return 26;
+	default: return 9 + 26;
+	}
+}
+
+// The value must be at most largestDigit(encoding)
+static char encodeCell(int value, CellEncoding encoding) {
+	if (value <= 0) return '.';
+	switch (encoding) {
+	case HexEncoding: return (char)(value <= 10 ? '0' + value - 1 : 'A' + value - 11);
+	case AlphabeticEncoding: return (char)('A' + value - 1);
+	default: return (char)(value <= 9 ? '0' + value : 'A' + value - 10);
+	}
+}
+
+bool parseEncoding(const char* name, CellEncoding& encoding) {
+	if (strcmp(name, "digits") == 0) encoding = DigitEncoding;
+	else if (strcmp(name, "hex") == 0) encoding = HexEncoding;
+	else if (strcmp(name, "alpha") == 0) encoding = AlphabeticEncoding;
+	else return false;
+	return true;
+}
+
+bool parsePuzzle(const char* line, size_t length, CellEncoding encoding, Sudoku& s) {
+	while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t' || line[length - 1] == '\r')) {
+		length--;
+	}
+	if (length != (size_t)s.size * s.size) return false;
+
+	const DecodeTable& table = decodeTable(encoding);
+	for (size_t i = 0; i < length; i++) {
+		int value = table.value[(unsigned char)line[i]];
+		if (value < 0 || value > s.size) return false;
+		// The line lists each row in turn, grid is indexed by column first
+		s.at((int)(i % s.size), (int)(i / s.size)) = (CellValue)(value > 0 ? value : -1);
+	}
+	return true;
+}
+
+size_t formatPuzzle(const Sudoku& s, CellEncoding encoding, char* out) {
+	int largest = largestDigit(encoding);
+	size_t i = 0;
+	for (int y = 0; y < s.size; y++) {
+		for (int x = 0; x < s.size; x++) {
+			int value = s.at(x, y);
+			if (value > largest) return 0;
+			out[i++] = encodeCell(value, encoding);
+		}
+	}
+	return i;
+}
+
+LineReader::LineReader(FILE* file) {
+	m_file = file;
+	m_buffer = new char[bufferSize];
+	m_start = 0;
+	m_end = 0;
+	m_lineNumber = 0;
+	m_eof = false;
+	m_skipping = false;
+}
+
+LineReader::~LineReader() {
+	delete[] m_buffer;
+}
+
+bool LineReader::next(const char*& line, size_t& length, bool& tooLong) {
+	tooLong = false;
+	while (true) {
+		char* newline = (char*)memchr(m_buffer + m_start, '\n', m_end - m_start);
+
+		if (m_skipping) {
+			// Throw away the rest of a line that was too long
+			if (newline) {
+				m_start = newline - m_buffer + 1;
+				m_skipping = false;
+				continue;
+			}
+			m_start = m_end;
+		}
+		else if (newline) {
+			line = m_buffer + m_start;
+			length = newline - line;
+			if (length > 0 && line[length - 1] == '\r') length--;
+			m_start = newline - m_buffer + 1;
+			m_lineNumber++;
+			return true;
+		}
+		else if (m_eof) {
+			if (m_start == m_end) return false;
+
+			// Last line without a line ending
+			line = m_buffer + m_start;
+			length = m_end - m_start;
+			m_start = m_end;
+			m_lineNumber++;
+			return true;
+		}
+		else if (m_end - m_start == bufferSize) {
+			line = m_buffer;
+			length = bufferSize;
+			tooLong = true;
+			m_start = m_end;
+			m_skipping = true;
+			m_lineNumber++;
+			return true;
+		}
+
+		if (m_eof) return false;
+
+		// Move what is left of the buffer to the front and fill the rest
+		memmove(m_buffer, m_buffer + m_start, m_end - m_start);
+		m_end -= m_start;
+		m_start = 0;
+		size_t read = fread(m_buffer + m_end, 1, bufferSize - m_end, m_file);
+		if (read == 0) m_eof = true;
+		m_end += read;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+
+#include "Sudoku.h"
+
+// Puzzles are written one per line, listing the cells row by row from the top left. Blank cells are '.' (or '0' where 0
+// is not a digit).
+enum CellEncoding {
+	DigitEncoding, // 1-9 then A, B, C... for 10 upwards. The usual 81 character format for 9x9.
+	HexEncoding, // 0-9 then A-F for the digits 1 to 16
+	AlphabeticEncoding // A-Z for the digits 1 to 26
+};
+
+// Parse the encoding name used on the command line. Returns false if the name is not recognised.
+bool parseEncoding(const char* name, CellEncoding& encoding);
+
+// Largest digit an encoding can write: 35 for digits, 16 for hex and 26 for alpha. Larger sudokus can't be written as text.
+int largestDigit(CellEncoding encoding);
+
+// Fill s from one line of text. Returns false if the line doesn't hold exactly s.size * s.size cells or a cell holds a
+// character that isn't a digit of this size. Trailing whitespace is ignored.
+bool parsePuzzle(const char* line, size_t length, CellEncoding encoding, Sudoku& s);
+
+// Write the grid as a line of s.size * s.size characters, unknown cells as '.'. out must have room for all of them.
+// Returns the number of characters written, or 0 if a cell holds a digit larger than largestDigit(encoding).
+size_t formatPuzzle(const Sudoku& s, CellEncoding encoding, char* out);
+
+// Reads a stream line by line through one fixed buffer, so a file of any length is read with constant memory.
+class LineReader {
+public:
+	LineReader(FILE* file);
+	~LineReader();
+
+	// Get the next line, without its line ending. The line stays valid until the next call.
+	// Lines longer than the buffer are returned with tooLong set and their contents cut short.
+	bool next(const char*& line, size_t& length, bool& tooLong);
+
+	size_t lineNumber() const { return m_lineNumber; }
+
+	static const size_t bufferSize = 1 << 20;
+
+private:
+	FILE* m_file;
+	char* m_buffer;
+	size_t m_start;
+	size_t m_end;
+	size_t m_lineNumber;
+	bool m_eof;
+	bool m_skipping; // the rest of a line that was too long is still to be thrown away
+
+	LineReader(const LineReader&) = delete;
+	LineReader& operator=(const LineReader&) = delete;
+};
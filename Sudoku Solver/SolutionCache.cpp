@@ -0,0 +1,192 @@
+#include "SolutionCache.h"
+#include "Canonical.h"
+
+#include <chrono>
+#include <functional>
+#include <iterator>
+
+// Grids a thread works with while using a cache, kept so that a lookup makes no heap allocations
+struct CacheScratch {
+	Sudoku puzzle; // as it was given, while it is solved with a budget
+	Sudoku canonical;
+	Sudoku solution;
+	GridTransform transform;
+	std::string key;
+};
+
+static CacheScratch& cacheScratch() {
+	thread_local CacheScratch scratch;
+	return scratch;
+}
+
+// The box shape followed by every cell, one byte each
+static void makeKey(const Sudoku& s, std::string& key) {
+	key.clear();
+	key.push_back((char)s.boxWidth);
+	key.push_back((char)s.boxHeight);
+	for (CellValue value : s.all()) {
+		key.push_back((char)value);
+	}
+}
+
+// Heap memory held by a string, nothing if it is short enough to be kept inside the string itself
+static size_t heapBytes(const std::string& s) {
+	const char* data = s.data();
+	bool inside = data >= (const char*)&s && data < (const char*)(&s + 1);
+	return inside ? 0 : s.capacity() + 1;
+}
+
+// Memory held for one entry: its list node and strings and its node in the index
+static size_t entryBytes(const std::string& key, const std::string& solution) {
+	return sizeof(std::string) * 2 + sizeof(void*) * 2 + heapBytes(key) + heapBytes(solution) +
+		sizeof(std::string_view) + sizeof(void*) * 2 + sizeof(size_t);
+}
+
+SolutionCache::SolutionCache(size_t capacity, long long lookupAfter) {
+	m_lookupAfter = lookupAfter;
+	// At least 256 puzzles a shard
+	m_numberOfShards = capacity / 256 < MaxShards ? (int)(capacity / 256) : MaxShards;
+	if (m_numberOfShards < 1) m_numberOfShards = 1;
+	m_shards.reset(new Shard[m_numberOfShards]);
+	m_skipped = 0;
+	m_solvedFirst = 0;
+	for (int i = 0; i < m_numberOfShards; i++) {
+		Shard& shard = m_shards[i];
+		shard.capacity = (capacity + m_numberOfShards - 1 - i) / m_numberOfShards;
+		shard.bytes = 0;
+		shard.hits = 0;
+		shard.misses = 0;
+	}
+}
+
+SolutionCache::Shard& SolutionCache::shardFor(const std::string& key) {
+	// The index hashes the key again, so take the shard from the high bits to leave the low ones spread out
+	size_t hash = std::hash<std::string_view>()(std::string_view(key));
+	return m_shards[(hash >> (sizeof(size_t) * 8 - 8)) % m_numberOfShards];
+}
+
+bool SolutionCache::find(const Sudoku& canonical, Sudoku& solution) {
+	std::string& key = cacheScratch().key;
+	makeKey(canonical, key);
+	Shard& shard = shardFor(key);
+
+	std::lock_guard<std::mutex> guard(shard.lock);
+	auto found = shard.index.find(std::string_view(key));
+	if (found == shard.index.end()) {
+		shard.misses++;
+		return false;
+	}
+	shard.hits++;
+	shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+
+	if (solution.boxWidth != canonical.boxWidth || solution.boxHeight != canonical.boxHeight) {
+		solution.reshape(canonical.boxWidth, canonical.boxHeight);
+	}
+	const std::string& cells = found->second->solution;
+	CellSpan grid = solution.all();
+	for (int cell = 0; cell < grid.size; cell++) {
+		grid[cell] = (CellValue)cells[cell];
+	}
+	return true;
+}
+
+void SolutionCache::insert(const Sudoku& canonical, const Sudoku& solution) {
+	std::string& key = cacheScratch().key;
+	makeKey(canonical, key);
+	Shard& shard = shardFor(key);
+
+	std::lock_guard<std::mutex> guard(shard.lock);
+	if (shard.capacity == 0) return;
+	auto found = shard.index.find(std::string_view(key));
+	if (found != shard.index.end()) {
+		// Another thread got there first
+		shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+		return;
+	}
+
+	if (shard.index.size() >= shard.capacity) {
+		// Reuse the least recently used entry, so its strings keep their buffers
+		auto oldest = std::prev(shard.entries.end());
+		shard.index.erase(std::string_view(oldest->key));
+		shard.bytes -= entryBytes(oldest->key, oldest->solution);
+		shard.entries.splice(shard.entries.begin(), shard.entries, oldest);
+	}
+	else {
+		shard.entries.emplace_front();
+	}
+	Entry& entry = shard.entries.front();
+	entry.key = key;
+	entry.solution.assign((const char*)solution.all().data, (size_t)solution.all().size);
+	shard.bytes += entryBytes(entry.key, entry.solution);
+	shard.index.emplace(std::string_view(entry.key), shard.entries.begin());
+}
+
+SolutionCacheStats SolutionCache::stats() const {
+	SolutionCacheStats stats;
+	stats.hits = 0;
+	stats.misses = 0;
+	stats.skipped = m_skipped.load();
+	stats.solvedFirst = m_solvedFirst.load();
+	stats.entries = 0;
+	stats.bytes = sizeof(*this) + sizeof(Shard) * m_numberOfShards;
+	for (int i = 0; i < m_numberOfShards; i++) {
+		const Shard& shard = m_shards[i];
+		std::lock_guard<std::mutex> guard(shard.lock);
+		stats.hits += shard.hits;
+		stats.misses += shard.misses;
+		stats.entries += (long long)shard.index.size();
+		stats.bytes += shard.bytes + shard.index.bucket_count() * sizeof(void*);
+	}
+	return stats;
+}
+
+int SolutionCache::solve(Sudoku& s, const SolveOptions& options) {
+	SolveOptions uncached = options;
+	uncached.cache = NULL;
+
+	CacheScratch& scratch = cacheScratch();
+	SolveStats quickStats;
+	if (m_lookupAfter > 0) {
+		// The time limit counts from now, not from each Solve()
+		if (uncached.timeLimit.count() > 0) {
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + uncached.timeLimit;
+			if (end < uncached.deadline) uncached.deadline = end;
+			uncached.timeLimit = std::chrono::microseconds(0);
+		}
+		SolveOptions quick = uncached;
+		if (quick.nodeLimit == 0 || quick.nodeLimit > m_lookupAfter) quick.nodeLimit = m_lookupAfter;
+		if (!quick.stats) quick.stats = &quickStats;
+		scratch.puzzle = s;
+		int numberOfSolutions = Solve(s, quick);
+		// Given up on for any other reason, or at the caller's own node limit, there is nothing more to do
+		if (numberOfSolutions != SolveAborted || quick.stats->aborted != NodeLimitReached || quick.nodeLimit == options.nodeLimit) {
+			m_solvedFirst++;
+			return numberOfSolutions;
+		}
+		quickStats = *quick.stats;
+		s = scratch.puzzle;
+	}
+
+	if (!canonicalize(s, scratch.canonical, scratch.transform)) {
+		m_skipped++;
+		return Solve(s, uncached);
+	}
+	if (find(scratch.canonical, scratch.solution)) {
+		undoTransform(scratch.solution, scratch.transform, s);
+		if (options.stats) {
+			*options.stats = SolveStats();
+			options.stats->nodes = quickStats.nodes;
+			options.stats->solutions = 1;
+		}
+		return 1;
+	}
+
+	int numberOfSolutions = Solve(s, uncached);
+	// A solution can only answer every mode if the search has shown it is the only one
+	long long limit = options.solutionLimit();
+	if (numberOfSolutions == 1 && (limit == 0 || limit >= 2)) {
+		applyTransform(s, scratch.transform, scratch.solution);
+		insert(scratch.canonical, scratch.solution);
+	}
+	return numberOfSolutions;
+}
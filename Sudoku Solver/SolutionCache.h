@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "Solver.h"
+#include "Sudoku.h"
+
+// Counters of a SolutionCache, read while it may still be in use so only roughly in step with each other
+struct SolutionCacheStats {
+	long long hits;
+	long long misses; // lookups that didn't find the puzzle
+	long long skipped; // puzzles solved without a lookup because their canonical form couldn't be found
+	long long solvedFirst; // puzzles solved in few enough guesses that they weren't looked up, see SolutionCache
+	long long entries;
+	size_t bytes; // memory held for the entries and the index, as near as can be worked out without asking the allocator
+
+	// Share of lookups answered from the cache
+	double hitRate() const {
+		long long lookups = hits + misses + skipped;
+		return lookups > 0 ? (double)hits / lookups : 0.0;
+	}
+};
+
+// Solutions of puzzles seen before, kept by the canonical form of each puzzle (see Canonical.h) so one that comes back
+// relabelled, reordered or transposed is answered without solving it again. Only puzzles proven to have exactly one
+// solution are kept. Once capacity puzzles are held, keeping another drops the one that was used least recently.
+//
+// Finding the canonical form of a puzzle costs as much as solving most 9x9 puzzles, so each puzzle is first solved with a
+// budget of lookupAfter guesses and only looked up, and kept, if that isn't enough. Easy puzzles are then solved at full
+// speed whether they repeat or not, and the cache is left to the puzzles that are worth it.
+//
+// A cache can be shared by any number of threads. The puzzles are divided between shards by a hash of their canonical
+// form, each with its own lock and its own share of the capacity, so threads rarely have to wait for each other. As the
+// puzzles don't divide evenly, a cache can start dropping puzzles a little before it holds capacity of them. Small caches
+// have fewer shards, as the shares would be too small to even out.
+class SolutionCache {
+public:
+	// lookupAfter of 0 looks up every puzzle
+	explicit SolutionCache(size_t capacity, long long lookupAfter = 32);
+
+	// Solve s with options, apart from options.cache, answering from the cache if a transform of s has been solved
+	// before. Solve() comes here when options.cache is set. A puzzle answered from the cache has one solution in
+	// options.stats and the guesses made before it was looked up.
+	int solve(Sudoku& s, const SolveOptions& options);
+
+	// Look up a puzzle in canonical form, setting solution to its canonical solution if it is there
+	bool find(const Sudoku& canonical, Sudoku& solution);
+
+	// Keep the solution of a puzzle in canonical form, which must be its only solution
+	void insert(const Sudoku& canonical, const Sudoku& solution);
+
+	SolutionCacheStats stats() const;
+
+private:
+	struct Entry {
+		std::string key;
+		std::string solution;
+	};
+
+	struct Shard {
+		mutable std::mutex lock;
+		std::list<Entry> entries; // most recently used first
+		std::unordered_map<std::string_view, std::list<Entry>::iterator> index; // keys point into the entries
+		size_t capacity;
+		size_t bytes;
+		long long hits;
+		long long misses;
+	};
+
+	static const int MaxShards = 16;
+	int m_numberOfShards;
+	long long m_lookupAfter;
+	std::unique_ptr<Shard[]> m_shards;
+	std::atomic<long long> m_skipped;
+	std::atomic<long long> m_solvedFirst;
+
+	Shard& shardFor(const std::string& key);
+};
@@ -0,0 +1,633 @@
+#include "SolveServer.h"
+#include "BatchSolver.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// A connection isn't read from while this much of its output is still to be sent, so a client that doesn't read its
+// results can't make the server hold on to them without limit
+static const size_t OutputLimit = 1 << 20;
+
+// Most puzzles a worker takes at once. Their results are handed back together, so a bigger batch saves locking but keeps
+// the first results waiting for the last.
+static const size_t MaxBatch = 32;
+
+static void putU32(unsigned char* out, uint32_t value) {
+	for (int i = 0; i < 4; i++) out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint32_t getU32(const unsigned char* in) {
+	return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+// Add the cells of s row by row to out, 0 for a blank cell
+static void appendCells(const Sudoku& s, std::vector<unsigned char>& out) {
+	for (int y = 0; y < s.size; y++) {
+		for (int x = 0; x < s.size; x++) {
+			int value = s.at(x, y);
+			out.push_back((unsigned char)(value > 0 ? value : 0));
+		}
+	}
+}
+
+// Fill s from cells row by row. Returns false if a cell holds a value above size.
+static bool readCells(const unsigned char* cells, Sudoku& s) {
+	bool valid = true;
+	for (int y = 0; y < s.size; y++) {
+		for (int x = 0; x < s.size; x++) {
+			int value = *cells++;
+			if (value > s.size) valid = false;
+			s.at(x, y) = (CellValue)(value > 0 ? value : -1);
+		}
+	}
+	return valid;
+}
+
+// Start a message with room for its length, filled in by endMessage
+static size_t beginMessage(std::vector<unsigned char>& out) {
+	size_t start = out.size();
+	out.resize(start + 4);
+	return start;
+}
+
+static void endMessage(std::vector<unsigned char>& out, size_t start) {
+	putU32(&out[start], (uint32_t)(out.size() - start - 4));
+}
+
+static void appendU32(std::vector<unsigned char>& out, uint32_t value) {
+	size_t at = out.size();
+	out.resize(at + 4);
+	putU32(&out[at], value);
+}
+
+void appendSolveRequest(const SolveRequest& request, std::vector<unsigned char>& out) {
+	size_t start = beginMessage(out);
+	out.push_back('S');
+	out.push_back(request.firstSolution ? 1 : 0);
+	out.push_back((unsigned char)request.sudoku.boxWidth);
+	out.push_back((unsigned char)request.sudoku.boxHeight);
+	appendU32(out, request.id);
+	appendU32(out, request.timeoutMs);
+	appendCells(request.sudoku, out);
+	endMessage(out, start);
+}
+
+void appendMetricsRequest(std::vector<unsigned char>& out) {
+	size_t start = beginMessage(out);
+	out.push_back('M');
+	endMessage(out, start);
+}
+
+size_t nextMessage(const unsigned char* data, size_t length, const unsigned char*& payload, size_t& payloadLength, bool& tooLong) {
+	tooLong = false;
+	if (length < 4) return 0;
+	payloadLength = getU32(data);
+	if (payloadLength > MaxServerMessage) {
+		tooLong = true;
+		return 0;
+	}
+	if (length - 4 < payloadLength) return 0;
+	payload = data + 4;
+	return 4 + payloadLength;
+}
+
+bool decodeSolveResponse(const unsigned char* payload, size_t length, SolveResponse& response) {
+	if (length < 8 || payload[0] != 'S') return false;
+	response.status = payload[1];
+	response.id = getU32(payload + 4);
+	if (response.status == ServerTimedOut || response.status == ServerInvalid) return length == 8;
+
+	int boxWidth = payload[2], boxHeight = payload[3];
+	if (boxWidth < 1 || boxHeight < 1 || boxWidth * boxHeight > MaxSudokuSize) return false;
+	size_t size = (size_t)boxWidth * boxHeight;
+	if (length != 8 + size * size) return false;
+	if (response.sudoku.boxWidth != boxWidth || response.sudoku.boxHeight != boxHeight) response.sudoku.reshape(boxWidth, boxHeight);
+	return readCells(payload + 8, response.sudoku);
+}
+
+static bool setNonBlocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+SolveServer::SolveServer(const ServerOptions& options) : m_stopping(false), m_wakePending(false) {
+	m_options = options;
+	m_threads = options.threads > 0 ? options.threads : defaultBatchThreads();
+	m_listener = -1;
+	m_nextConnection = 0;
+	m_totalWaitMs = 0;
+	m_waited = 0;
+	memset(&m_metrics, 0, sizeof(m_metrics));
+
+	int fds[2];
+	if (pipe(fds) == 0) {
+		m_wakeRead = fds[0];
+		m_wakeWrite = fds[1];
+		setNonBlocking(m_wakeRead);
+		setNonBlocking(m_wakeWrite);
+	}
+	else {
+		m_wakeRead = m_wakeWrite = -1;
+	}
+}
+
+SolveServer::~SolveServer() {
+	for (auto& entry : m_connections) {
+		::close(entry.second.fd);
+	}
+	if (m_listener >= 0) ::close(m_listener);
+	if (!m_unixPath.empty()) unlink(m_unixPath.data());
+	if (m_wakeRead >= 0) ::close(m_wakeRead);
+	if (m_wakeWrite >= 0) ::close(m_wakeWrite);
+}
+
+bool SolveServer::listenUnix(const char* path) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	strcpy(address.sun_path, path);
+
+	// A socket left behind by a server that didn't shut down cleanly would stop bind() working
+	struct stat info;
+	if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return false;
+	if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0 || !setNonBlocking(fd)) {
+		int error = errno;
+		::close(fd);
+		errno = error;
+		return false;
+	}
+	m_listener = fd;
+	m_unixPath.assign(path, path + strlen(path) + 1);
+	return true;
+}
+
+bool SolveServer::listenTcp(int port) {
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons((uint16_t)port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return false;
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0 || !setNonBlocking(fd)) {
+		int error = errno;
+		::close(fd);
+		errno = error;
+		return false;
+	}
+	m_listener = fd;
+	return true;
+}
+
+int SolveServer::port() const {
+	sockaddr_in address;
+	socklen_t length = sizeof(address);
+	if (m_listener < 0 || getsockname(m_listener, (sockaddr*)&address, &length) != 0 || address.sin_family != AF_INET) return 0;
+	return ntohs(address.sin_port);
+}
+
+void SolveServer::stop() {
+	// Only what a signal handler may do: an atomic store and a write
+	m_stopping = true;
+	char byte = 0;
+	if (write(m_wakeWrite, &byte, 1) < 0) {
+		// The pipe is full, so the I/O thread is going to wake up anyway
+	}
+}
+
+void SolveServer::wake() {
+	if (m_wakePending.exchange(true)) return;
+	char byte = 0;
+	if (write(m_wakeWrite, &byte, 1) < 0) {
+		// As in stop()
+	}
+}
+
+ServerMetrics SolveServer::metrics() const {
+	std::lock_guard<std::mutex> guard(m_metricsLock);
+	ServerMetrics metrics = m_metrics;
+	metrics.meanBatch = metrics.batches > 0 ? (double)m_waited / metrics.batches : 0.0;
+	metrics.meanWaitMs = m_waited > 0 ? m_totalWaitMs / m_waited : 0.0;
+	return metrics;
+}
+
+void SolveServer::run() {
+	std::vector<std::thread> workers;
+	for (int i = 0; i < m_threads; i++) {
+		workers.emplace_back(&SolveServer::work, this);
+	}
+
+	std::vector<pollfd> fds;
+	std::vector<uint64_t> serials; // connection of each entry of fds after the first ones
+	std::vector<uint64_t> closing;
+	while (!m_stopping) {
+		size_t queued;
+		{
+			std::lock_guard<std::mutex> guard(m_queueLock);
+			queued = m_queue.size();
+		}
+
+		fds.clear();
+		serials.clear();
+		fds.push_back(pollfd{ m_wakeRead, POLLIN, 0 });
+		if (m_listener >= 0) fds.push_back(pollfd{ m_listener, POLLIN, 0 });
+		size_t first = fds.size();
+		for (auto& entry : m_connections) {
+			Connection& connection = entry.second;
+			short events = 0;
+			// Leave requests unread while the workers have plenty to do, so the queue can't grow without limit
+			if (connection.reading && queued < m_options.maxQueued && connection.output.size() - connection.written < OutputLimit) {
+				events |= POLLIN;
+			}
+			if (connection.written < connection.output.size()) events |= POLLOUT;
+			fds.push_back(pollfd{ connection.fd, events, 0 });
+			serials.push_back(entry.first);
+		}
+
+		int timeout = -1;
+		if (!m_timeouts.empty()) {
+			auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(m_timeouts.begin()->first - Clock::now());
+			timeout = wait.count() < 0 ? 0 : (int)wait.count() + 1;
+		}
+		if (poll(fds.data(), (nfds_t)fds.size(), timeout) < 0 && errno != EINTR) break;
+
+		if (fds[0].revents & POLLIN) {
+			m_wakePending = false;
+			char buffer[256];
+			while (read(m_wakeRead, buffer, sizeof(buffer)) > 0) {
+			}
+		}
+		if (m_listener >= 0 && (fds[1].revents & POLLIN)) accept();
+
+		closing.clear();
+		for (size_t i = 0; i < serials.size(); i++) {
+			short revents = fds[first + i].revents;
+			if (revents == 0) continue;
+			Connection& connection = m_connections[serials[i]];
+			// Once the other side has stopped sending, a hang up means it has gone altogether
+			if ((revents & POLLERR) || ((revents & POLLHUP) && !connection.reading) ||
+				((revents & (POLLIN | POLLHUP)) && !readFrom(serials[i], connection)) ||
+				((revents & POLLOUT) && !flush(connection))) {
+				closing.push_back(serials[i]);
+			}
+		}
+		for (uint64_t serial : closing) {
+			close(serial);
+		}
+
+		queueIncoming();
+		finishJobs();
+		expireTimeouts();
+
+		// Send what is ready straight away rather than wait for the next poll, and let go of connections that are done
+		closing.clear();
+		for (auto& entry : m_connections) {
+			Connection& connection = entry.second;
+			if (connection.written < connection.output.size() && !flush(connection)) {
+				closing.push_back(entry.first);
+			}
+			else if (!connection.reading && connection.inFlight == 0 && connection.written == connection.output.size()) {
+				closing.push_back(entry.first);
+			}
+		}
+		for (uint64_t serial : closing) {
+			close(serial);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(m_queueLock);
+		m_stopping = true;
+	}
+	m_queueSignal.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+void SolveServer::accept() {
+	while (true) {
+		int fd = ::accept(m_listener, NULL, NULL);
+		if (fd < 0) return;
+		setNonBlocking(fd);
+		// Results are small and a client may be waiting on each one, so send them without delay. Fails harmlessly on a
+		// Unix domain socket.
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		Connection& connection = m_connections[m_nextConnection++];
+		connection.fd = fd;
+		connection.written = 0;
+		connection.inFlight = 0;
+		connection.reading = true;
+
+		std::lock_guard<std::mutex> guard(m_metricsLock);
+		m_metrics.connections++;
+	}
+}
+
+bool SolveServer::readFrom(uint64_t serial, Connection& connection) {
+	if (!connection.reading) return true;
+
+	// Read what has arrived, up to a limit so one busy connection can't keep the others waiting
+	std::vector<unsigned char>& input = connection.input;
+	for (int reads = 0; reads < 16; reads++) {
+		size_t used = input.size();
+		input.resize(used + 65536);
+		ssize_t length = read(connection.fd, input.data() + used, 65536);
+		input.resize(used + (length > 0 ? (size_t)length : 0));
+		if (length == 0) {
+			connection.reading = false;
+			break;
+		}
+		if (length < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+			return false;
+		}
+	}
+
+	size_t offset = 0;
+	while (true) {
+		const unsigned char* payload;
+		size_t payloadLength;
+		bool tooLong;
+		size_t taken = nextMessage(input.data() + offset, input.size() - offset, payload, payloadLength, tooLong);
+		if (tooLong) return false;
+		if (taken == 0) break;
+		if (!handleMessage(serial, connection, payload, payloadLength)) return false;
+		offset += taken;
+	}
+	input.erase(input.begin(), input.begin() + offset);
+	return true;
+}
+
+bool SolveServer::handleMessage(uint64_t serial, Connection& connection, const unsigned char* payload, size_t length) {
+	if (length == 0) return false;
+
+	if (payload[0] == 'M' && length == 1) {
+		ServerMetrics metrics = this->metrics();
+		char text[512];
+		int n = snprintf(text, sizeof(text),
+			"queued %lld\nsolving %lld\nmax_queued %lld\nconnections %lld\nrequests %lld\nsolved %lld\ntimed_out %lld\n"
+			"invalid %lld\nbatches %lld\nmean_batch %.2f\nmean_wait_ms %.3f\n",
+			metrics.queued, metrics.solving, metrics.maxQueued, metrics.connections, metrics.requests, metrics.solved,
+			metrics.timedOut, metrics.invalid, metrics.batches,
+			metrics.meanBatch, metrics.meanWaitMs);
+		size_t start = beginMessage(connection.output);
+		connection.output.push_back('M');
+		connection.output.insert(connection.output.end(), text, text + n);
+		endMessage(connection.output, start);
+		return true;
+	}
+	if (payload[0] != 'S' || length < 12) return false;
+
+	{
+		std::lock_guard<std::mutex> guard(m_metricsLock);
+		m_metrics.requests++;
+	}
+
+	Job* job;
+	if (!m_freeJobs.empty()) {
+		job = m_freeJobs.back();
+		m_freeJobs.pop_back();
+	}
+	else {
+		m_jobs.emplace_back(new Job());
+		job = m_jobs.back().get();
+	}
+	job->connection = serial;
+	job->id = getU32(payload + 4);
+	job->mode = (payload[1] & 1) ? FindAny : ProveUnique;
+	job->received = Clock::now();
+	job->hasDeadline = false;
+	job->answered = false;
+	job->cancel.reset();
+	job->active = true;
+	job->status = 0;
+	connection.inFlight++;
+
+	int boxWidth = payload[2], boxHeight = payload[3];
+	size_t size = (size_t)boxWidth * boxHeight;
+	bool valid = boxWidth >= 1 && boxHeight >= 1 && size <= MaxSudokuSize && length == 12 + size * size;
+	if (valid) {
+		if (job->sudoku.boxWidth != boxWidth || job->sudoku.boxHeight != boxHeight) job->sudoku.reshape(boxWidth, boxHeight);
+		valid = readCells(payload + 12, job->sudoku);
+	}
+	if (!valid) {
+		// Answered straight away, going through the same steps as a solved job. The job's sudoku may still have the
+		// shape of an earlier request, so the reply echoes the shape this request asked for.
+		job->answered = true;
+		respond(connection, *job, ServerInvalid, boxWidth, boxHeight);
+		connection.inFlight--;
+		job->active = false;
+		m_freeJobs.push_back(job);
+		std::lock_guard<std::mutex> guard(m_metricsLock);
+		m_metrics.invalid++;
+		return true;
+	}
+
+	uint32_t timeoutMs = getU32(payload + 8);
+	if (timeoutMs == 0) timeoutMs = m_options.timeoutMs;
+	if (timeoutMs > 0) {
+		job->hasDeadline = true;
+		job->deadline = job->received + std::chrono::milliseconds(timeoutMs);
+		job->timeout = m_timeouts.emplace(job->deadline, job);
+	}
+	m_incoming.push_back(job);
+	return true;
+}
+
+void SolveServer::queueIncoming() {
+	if (m_incoming.empty()) return;
+	size_t added = m_incoming.size();
+	{
+		std::lock_guard<std::mutex> guard(m_queueLock);
+		m_queue.insert(m_queue.end(), m_incoming.begin(), m_incoming.end());
+		std::lock_guard<std::mutex> metricsGuard(m_metricsLock);
+		m_metrics.queued = (long long)m_queue.size();
+		if (m_metrics.queued > m_metrics.maxQueued) m_metrics.maxQueued = m_metrics.queued;
+	}
+	m_incoming.clear();
+	if (added == 1) m_queueSignal.notify_one();
+	else m_queueSignal.notify_all();
+}
+
+void SolveServer::work() {
+	SolveOptions options = m_options.solve;
+	std::vector<Job*> batch;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(m_queueLock);
+			m_queueSignal.wait(guard, [&] { return !m_queue.empty() || m_stopping; });
+			if (m_stopping) return;
+
+			// An even share of what is waiting, so the other workers have something to take too
+			size_t take = (m_queue.size() + m_threads - 1) / m_threads;
+			if (take > MaxBatch) take = MaxBatch;
+			batch.assign(m_queue.begin(), m_queue.begin() + take);
+			m_queue.erase(m_queue.begin(), m_queue.begin() + take);
+
+			std::lock_guard<std::mutex> metricsGuard(m_metricsLock);
+			m_metrics.queued = (long long)m_queue.size();
+			m_metrics.solving += (long long)take;
+			m_metrics.batches++;
+		}
+
+		double waitMs = 0;
+		for (Job* job : batch) {
+			Clock::time_point now = Clock::now();
+			waitMs += std::chrono::duration<double, std::milli>(now - job->received).count();
+			if (job->cancel.cancelled() || (job->hasDeadline && now >= job->deadline)) {
+				job->status = ServerTimedOut;
+				continue;
+			}
+			// A puzzle still being solved at its deadline, or once its connection has closed, is given up on
+			options.mode = job->mode;
+			options.deadline = job->hasDeadline ? job->deadline : Clock::time_point::max();
+			options.cancel = &job->cancel;
+			job->status = Solve(job->sudoku, options);
+			if (job->status == SolveAborted) job->status = ServerTimedOut;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(m_doneLock);
+			m_done.insert(m_done.end(), batch.begin(), batch.end());
+		}
+		{
+			std::lock_guard<std::mutex> guard(m_metricsLock);
+			m_metrics.solving -= (long long)batch.size();
+			m_totalWaitMs += waitMs;
+			m_waited += (long long)batch.size();
+		}
+		wake();
+	}
+}
+
+void SolveServer::finishJobs() {
+	{
+		std::lock_guard<std::mutex> guard(m_doneLock);
+		if (m_done.empty()) return;
+		// The workers go on with the buffer of the last batch handed back
+		m_finished.swap(m_done);
+	}
+
+	long long solved = 0, timedOut = 0;
+	for (Job* job : m_finished) {
+		if (!job->answered) {
+			if (job->hasDeadline) m_timeouts.erase(job->timeout);
+			auto found = m_connections.find(job->connection);
+			if (found != m_connections.end()) {
+				respond(found->second, *job, job->status);
+				found->second.inFlight--;
+			}
+			if (job->status == ServerTimedOut) timedOut++;
+			else solved++;
+		}
+		job->active = false;
+		m_freeJobs.push_back(job);
+	}
+	m_finished.clear();
+
+	std::lock_guard<std::mutex> guard(m_metricsLock);
+	m_metrics.solved += solved;
+	m_metrics.timedOut += timedOut;
+}
+
+void SolveServer::expireTimeouts() {
+	Clock::time_point now = Clock::now();
+	long long timedOut = 0;
+	while (!m_timeouts.empty() && m_timeouts.begin()->first <= now) {
+		// The job may still be queued or being solved, it is let go of once a worker hands it back
+		Job* job = m_timeouts.begin()->second;
+		m_timeouts.erase(m_timeouts.begin());
+		job->answered = true;
+		auto found = m_connections.find(job->connection);
+		if (found != m_connections.end()) {
+			respond(found->second, *job, ServerTimedOut);
+			found->second.inFlight--;
+		}
+		timedOut++;
+	}
+	if (timedOut == 0) return;
+	std::lock_guard<std::mutex> guard(m_metricsLock);
+	m_metrics.timedOut += timedOut;
+}
+
+void SolveServer::respond(Connection& connection, const Job& job, int status) {
+	respond(connection, job, status, job.sudoku.boxWidth, job.sudoku.boxHeight);
+}
+
+void SolveServer::respond(Connection& connection, const Job& job, int status, int boxWidth, int boxHeight) {
+	std::vector<unsigned char>& out = connection.output;
+	size_t start = beginMessage(out);
+	out.push_back('S');
+	out.push_back((unsigned char)status);
+	out.push_back((unsigned char)boxWidth);
+	out.push_back((unsigned char)boxHeight);
+	appendU32(out, job.id);
+	if (status < ServerTimedOut) appendCells(job.sudoku, out);
+	endMessage(out, start);
+}
+
+bool SolveServer::flush(Connection& connection) {
+	std::vector<unsigned char>& output = connection.output;
+	while (connection.written < output.size()) {
+		ssize_t sent = send(connection.fd, output.data() + connection.written, output.size() - connection.written, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+			return false;
+		}
+		connection.written += (size_t)sent;
+	}
+	if (connection.written == output.size()) {
+		output.clear();
+		connection.written = 0;
+	}
+	else if (connection.written >= 65536) {
+		output.erase(output.begin(), output.begin() + connection.written);
+		connection.written = 0;
+	}
+	return true;
+}
+
+void SolveServer::close(uint64_t serial) {
+	auto found = m_connections.find(serial);
+	if (found == m_connections.end()) return;
+
+	// Nothing will be sent for the jobs still out, so the workers can skip them
+	for (const std::unique_ptr<Job>& job : m_jobs) {
+		if (!job->active || job->answered || job->connection != serial) continue;
+		job->cancel.cancel();
+		job->answered = true;
+		if (job->hasDeadline) m_timeouts.erase(job->timeout);
+	}
+	::close(found->second.fd);
+	m_connections.erase(found);
+
+	std::lock_guard<std::mutex> guard(m_metricsLock);
+	m_metrics.connections--;
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Solver.h"
+#include "Sudoku.h"
+
+// A long running solver that takes puzzles over a Unix domain socket or a loopback TCP port, so a service can keep one
+// warm process rather than start a program for every puzzle. Only built where there are POSIX sockets.
+//
+// Every message in either direction is a 4 byte length followed by that many bytes of payload, all numbers little
+// endian. The first byte of a payload says what it is:
+//
+//   'S' solve request   byte 1: flags, bit 0 stops at the first solution rather than proving it is the only one
+//                       bytes 2-3: box width and height
+//                       bytes 4-7: id, sent back with the result
+//                       bytes 8-11: timeout in milliseconds, 0 for the server's default
+//                       then size * size bytes, the cells row by row from the top left, 0 for a blank cell
+//   'S' result          byte 1: status, the number of solutions (0, 1 or 2 for more than one), ServerTimedOut or
+//                       ServerInvalid
+//                       bytes 2-3: box width and height
+//                       bytes 4-7: id of the request
+//                       then, for a status of 0, 1 or 2, the cells of the grid as in the request: the solution, or
+//                       with no solution as much as could be worked out
+//   'M' metrics request nothing else
+//   'M' metrics         lines of "name value" text, see ServerMetrics
+//
+// A connection can send any number of requests without waiting for the results, which come back in the order they are
+// finished rather than the order they were sent. A request that can't be solved before its timeout is answered with
+// ServerTimedOut once the time is up, and a worker still solving it gives up. A connection that sends a message too long or of an unknown kind is closed.
+
+const int ServerTimedOut = 254;
+const int ServerInvalid = 255;
+
+// Longest payload either side sends, enough for the largest grid
+const size_t MaxServerMessage = 12 + MaxSudokuSize * MaxSudokuSize;
+
+struct SolveRequest {
+	uint32_t id;
+	uint32_t timeoutMs;
+	bool firstSolution;
+	Sudoku sudoku;
+};
+
+struct SolveResponse {
+	uint32_t id;
+	int status;
+	Sudoku sudoku; // only filled in for a status of 0, 1 or 2
+};
+
+// Add a whole message to the end of out
+void appendSolveRequest(const SolveRequest& request, std::vector<unsigned char>& out);
+void appendMetricsRequest(std::vector<unsigned char>& out);
+
+// Find the first whole message in data. Returns the number of bytes it takes up, length included, or 0 if data doesn't
+// hold all of it yet. tooLong is set if the length is more than MaxServerMessage.
+size_t nextMessage(const unsigned char* data, size_t length, const unsigned char*& payload, size_t& payloadLength, bool& tooLong);
+
+// Read the payload of a result. Returns false if it isn't a well formed result.
+bool decodeSolveResponse(const unsigned char* payload, size_t length, SolveResponse& response);
+
+struct ServerOptions {
+	int threads; // solver threads, 0 for one per core
+	uint32_t timeoutMs; // used for requests that don't give a timeout, 0 for none
+	size_t maxQueued; // connections aren't read from while this many puzzles are waiting for a worker
+	SolveOptions solve; // how each puzzle is solved, apart from the mode a request asks for
+
+	ServerOptions() {
+		threads = 0;
+		timeoutMs = 0;
+		maxQueued = 4096;
+	}
+};
+
+// Counters of a server, as sent in reply to a metrics request. Taken while the server is running, so only roughly in
+// step with each other.
+struct ServerMetrics {
+	long long queued; // puzzles waiting for a worker
+	long long solving; // puzzles taken by a worker and not finished yet
+	long long maxQueued; // most puzzles that have been waiting at once
+	long long connections; // connections open
+	long long requests; // solve requests read, including invalid ones
+	long long solved;
+	long long timedOut;
+	long long invalid;
+	long long batches; // times a worker took puzzles from the queue
+	double meanBatch; // mean number of puzzles taken at once
+	double meanWaitMs; // mean time a puzzle waited for a worker
+};
+
+// Serves solve requests on one thread, handing the puzzles to a pool of workers. Puzzles that arrive together, on one
+// connection or on several, are queued together, and each worker takes its share of the queue at once rather than a
+// puzzle at a time.
+class SolveServer {
+public:
+	explicit SolveServer(const ServerOptions& options);
+	~SolveServer();
+
+	// Listen on a Unix domain socket, replacing a socket left at path by an earlier server, or on a TCP port of the
+	// loopback address (0 picks a free one, see port()). Returns false with errno set if it couldn't.
+	bool listenUnix(const char* path);
+	bool listenTcp(int port);
+	int port() const;
+
+	// Serve requests until stop() is called
+	void run();
+
+	// Make run() return once the puzzles being solved are finished. Safe to call from a signal handler.
+	void stop();
+
+	ServerMetrics metrics() const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Job {
+		uint64_t connection; // serial number of the connection the request came on
+		uint32_t id;
+		int status;
+		SolveMode mode;
+		Clock::time_point received;
+		Clock::time_point deadline;
+		std::multimap<Clock::time_point, Job*>::iterator timeout; // in m_timeouts, if the job has a deadline
+		bool hasDeadline;
+		bool active; // read and not yet handed back by a worker
+		bool answered; // a result has already been sent back, e.g. because the request timed out
+		CancelToken cancel; // cancelled once the connection has closed, so there is no point solving it
+		Sudoku sudoku;
+	};
+
+	struct Connection {
+		int fd;
+		std::vector<unsigned char> input;
+		std::vector<unsigned char> output;
+		size_t written; // bytes at the front of output that have been sent
+		long long inFlight; // requests read whose results haven't been sent
+		bool reading; // false once the other side has stopped sending
+	};
+
+	ServerOptions m_options;
+	int m_threads;
+	int m_listener;
+	std::vector<char> m_unixPath; // removed again when the server is destroyed
+	int m_wakeRead, m_wakeWrite; // a pipe the workers and stop() write to to wake the I/O thread
+	std::atomic<bool> m_stopping;
+	std::atomic<bool> m_wakePending;
+
+	// Owned by the I/O thread
+	std::unordered_map<uint64_t, Connection> m_connections;
+	uint64_t m_nextConnection;
+	std::vector<std::unique_ptr<Job>> m_jobs; // every job ever made, so they can be reused
+	std::vector<Job*> m_freeJobs;
+	std::multimap<Clock::time_point, Job*> m_timeouts;
+	std::vector<Job*> m_incoming; // read since the last time puzzles were queued
+
+	// Shared with the workers
+	std::mutex m_queueLock;
+	std::condition_variable m_queueSignal;
+	std::deque<Job*> m_queue;
+	std::mutex m_doneLock;
+	std::vector<Job*> m_done;
+	std::vector<Job*> m_finished; // jobs taken from m_done, owned by the I/O thread
+
+	mutable std::mutex m_metricsLock;
+	ServerMetrics m_metrics;
+	double m_totalWaitMs;
+	long long m_waited; // puzzles taken by workers
+
+	void work();
+	void wake();
+	void accept();
+	bool readFrom(uint64_t serial, Connection& connection);
+	bool handleMessage(uint64_t serial, Connection& connection, const unsigned char* payload, size_t length);
+	void queueIncoming();
+	void finishJobs();
+	void expireTimeouts();
+	void respond(Connection& connection, const Job& job, int status);
+	// The same with the box shape given, for a request rejected before its shape was taken into the job's sudoku
+	void respond(Connection& connection, const Job& job, int status, int boxWidth, int boxHeight);
+	bool flush(Connection& connection);
+	void close(uint64_t serial);
+
+	SolveServer(const SolveServer&) = delete;
+	SolveServer& operator=(const SolveServer&) = delete;
+};
@@ -1,6 +1,51 @@
 #include "Solver.h"
+#include "DancingLinks.h"
+#include "SolutionCache.h"
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Solve using the lookup tables of one sudoku shape
+template <class G>
+static int solveWith(Sudoku& s, const G& g, const SolveOptions& options);
+
+// Memory a solve on one thread works in, kept per thread and reused from one sudoku to the next. Once a thread has solved
+// a sudoku of some shape, solving another of the same shape on one thread makes no heap allocations.
+struct SolverArena {
+	SolveData data;
+	std::vector<int> solution; // storage for SearchState::solution
+	bool inUse; // a solve on this thread is using the arena, e.g. Solve() has been called again from onSolution
+
+	SolverArena() {
+		inUse = false;
+	}
+};
+
+static SolverArena& threadArena() {
+	thread_local SolverArena arena;
+	return arena;
+}
+
+// Lookup tables for a shape without a specialised solver. Building them allocates, so each thread keeps the last ones it built.
+static const RuntimeGeometry& runtimeGeometry(int boxWidth, int boxHeight) {
+	thread_local std::unique_ptr<RuntimeGeometry> geometry;
+	if (!geometry || geometry->boxWidth != boxWidth || geometry->boxHeight != boxHeight) {
+		geometry.reset(new RuntimeGeometry(boxWidth, boxHeight));
+	}
+	return *geometry;
+}
 
 int Solve(Sudoku& s) {
+	return Solve(s, SolveOptions());
+}
+
+int Solve(Sudoku& s, const SolveOptions& options) {
 
 	/*
 	Algorithm
@@ -46,74 +91,87 @@ int Solve(Sudoku& s) {
 
 	// I might want to copy the sudoku grid and only make changes to the original at certain time intervals and once the puzzle is solved.
 
+	if (options.stats) *options.stats = SolveStats();
+	// Digit sets are single words, see DigitMask.h
+	if (s.size < 1 || s.size > MaxSudokuSize) return 0;
+	if (options.cache && !options.grade && !options.onSolution) return options.cache->solve(s, options);
+	if (options.engine == DancingLinksEngine) return solveExactCover(s, options);
+
+	// Use a solver specialised for the shape of the sudoku when there is one
+	if (s.boxWidth == 2 && s.boxHeight == 2) return solveWith(s, Geometry<2, 2>(), options);
+	if (s.boxWidth == 2 && s.boxHeight == 3) return solveWith(s, Geometry<2, 3>(), options);
+	if (s.boxWidth == 3 && s.boxHeight == 2) return solveWith(s, Geometry<3, 2>(), options);
+	if (s.boxWidth == 3 && s.boxHeight == 3) return solveWith(s, Geometry<3, 3>(), options);
+	if (s.boxWidth == 3 && s.boxHeight == 4) return solveWith(s, Geometry<3, 4>(), options);
+	if (s.boxWidth == 4 && s.boxHeight == 3) return solveWith(s, Geometry<4, 3>(), options);
+	if (s.boxWidth == 4 && s.boxHeight == 4) return solveWith(s, Geometry<4, 4>(), options);
+	if (s.boxWidth == 5 && s.boxHeight == 5) return solveWith(s, Geometry<5, 5>(), options);
+	// A solve nested in another from onSolution builds tables of its own, as the outer one may still be using the thread's
+	if (threadArena().inUse) return solveWith(s, RuntimeGeometry(s.boxWidth, s.boxHeight), options);
+	return solveWith(s, runtimeGeometry(s.boxWidth, s.boxHeight), options);
+}
 
+template <class G>
+static void searchParallel(SolveData& sd, const G& g, SearchState& state, const SolveOptions& options);
 
+template <class G>
+static int solveIn(SolverArena& arena, Sudoku& s, const G& g, const SolveOptions& options);
 
-	// Prepare possibility table
-	PossibilityTable possibleDigits = new PossibilityArray[s.size];
-	for (int x = 0; x < s.size; x++) {
-		possibleDigits[x] = new std::vector<bool>[s.size];
-		for (int y = 0; y < s.size; y++) {
-			possibleDigits[x][y] = std::vector<bool>();
-			// First bit -> whether cell has been "solved". All others represent whether the algorithm considers a digit as possible
-			possibleDigits[x][y].push_back(false);
-			for (int d = 0; d < s.size; d++) {
-				possibleDigits[x][y].push_back(true);
-			}
-		}
+template <class G>
+static int solveWith(Sudoku& s, const G& g, const SolveOptions& options) {
+	SolverArena& arena = threadArena();
+	if (arena.inUse) {
+		// Only a nested solve gets memory of its own
+		SolverArena nested;
+		return solveIn(nested, s, g, options);
 	}
+	arena.inUse = true;
+	int numberOfSolutions = solveIn(arena, s, g, options);
+	arena.inUse = false;
+	return numberOfSolutions;
+}
 
-	// Create tables for boxes, rows and colums to keep track of how many cells remain unknown.
-	// Boxes
-	PossibilityTable boxTable = new PossibilityArray[s.boxHeight];
-
-	// Number of boxes in x axis = height of boxes and number of boxes in y axis = width of boxes
-	for (int x = 0; x < s.boxHeight; x++) {
-		boxTable[x] = new std::vector<bool>[s.boxWidth];
-		for (int y = 0; y < s.boxWidth; y++) {
-			boxTable[x][y] = std::vector<bool>();
-			// First bit -> whether box has been "solved". All others represent whether each digit has been placed in the box
-			boxTable[x][y].push_back(false);
-			for (int d = 0; d < s.size; d++) {
-				boxTable[x][y].push_back(false);
-			}
-		}
+template <class G>
+static int solveIn(SolverArena& arena, Sudoku& s, const G& g, const SolveOptions& options) {
+	// Prepare possibility table. Every cell starts off able to be any digit and no digit has been placed in any box/row/column.
+	SolveData& data = arena.data;
+	data.reset(g.size, g.boxWidth, g.boxHeight);
+	data.subsetSize = options.subsetSize;
+	data.heuristic = options.heuristic;
+
+	// Apply rule 1 to givens. The grid is stored in cell order, so it can be read straight through.
+	for (int cell = 0; cell < g.cells; cell++) {
+		int value = s[cell];
+		if (value <= 0) continue;
+		// No cell can hold a digit past the size, and digitBit() can't shift that far
+		if (value > g.size) return 0;
+		// Another given has already ruled this digit out so the clues are invalid
+		if (!(data.t[cell] & digitBit(value))) return 0;
+		// Placed while applying rule 1 to an earlier given
+		if (data.v[cell] > 0) continue;
+		if (!resolve(data, g, cell, value)) return 0;
 	}
 
-	PossibilityArray rowsTable = new std::vector<bool>[s.size];
-	PossibilityArray columnsTable = new std::vector<bool>[s.size];
-
-	for (int x = 0; x < s.size; x++) {
-		rowsTable[x] = std::vector<bool>();
-		columnsTable[x] = std::vector<bool>();
-
-		// First bit -> whether row/column has been "solved". All others represent whether each digit has been placed in the row/column
-		rowsTable[x].push_back(false);
-		columnsTable[x].push_back(false);
-		for (int d = 0; d < s.size; d++) {
-			rowsTable[x].push_back(false);
-			columnsTable[x].push_back(false);
+	// Grading makes its way as far as the rules go in order of difficulty before the search starts
+	if (options.grade) {
+		SolveStats grading;
+		int givens = 0;
+		for (int cell = 0; cell < g.cells; cell++) {
+			if (s[cell] > 0) givens++;
 		}
-	}
-
-	SolveData data;
-	data.t = possibleDigits;
-	data.b = boxTable;
-	data.r = rowsTable;
-	data.c = columnsTable;
-	data.size = s.size;
-	data.boxWidth = s.boxWidth;
-	data.boxHeight = s.boxHeight;
-
-
-	// Apply rule 1 to givens.
-	for (int x = 0; x < s.size; x++) {
-		for (int y = 0; y < s.size; y++) {
-			if (s.grid[x][y] > 0) {
-				resolve(s, data, x, y, s.grid[x][y]);
-			}
+		bool valid = applyRulesGraded(data, g, grading);
+		int solved = 0;
+		for (int cell = 0; cell < g.cells; cell++) {
+			if (data.v[cell] > 0) solved++;
+		}
+		grading.uses[NakedSingle] = solved - givens - grading.uses[HiddenSingle];
+		if (valid && !isSolved(data, g)) {
+			grading.guessed = true;
+			grading.hardest = Guessing;
 		}
-	}	
+		if (options.stats) *options.stats = grading;
+		if (!valid) return 0;
+	}
 
 	//std::ofstream f("possibilityTable.txt");
 
@@ -121,7 +179,7 @@ int Solve(Sudoku& s) {
 	//	for (int y = 0; y < s.size; y++) {
 	//		f << x << " " << y << " : ";
 	//		for (int d = 1; d < s.size+1; d++) {
-	//			if (possibleDigits[x][y][d] == true) {
+	//			if (data.t[x * s.size + y] & digitBit(d)) {
 	//				f << d << " ";
 	//			}
 	//		}
@@ -130,18 +188,406 @@ int Solve(Sudoku& s) {
 	//}
 
 	//f.close();
-	return recursiveSolve(s,data);
+	// The first solution is copied into the arena's vector rather than a new one
+	SearchState state(options);
+	state.solution.swap(arena.solution);
+	if (options.threads > 1) {
+		searchParallel(data, g, state, options);
+	}
+	else {
+		searchSolve(data, g, state);
+	}
+	// Several threads may each find a solution after the limit has been reached
+	long long found = state.numberOfSolutions;
+	if (state.limit > 0 && found > state.limit) found = state.limit;
+	// Another thread may give up while the solution limit is being reached, which still answers the question
+	AbortReason aborted = (AbortReason)state.aborted.load();
+	if (state.limit > 0 && found == state.limit) aborted = NotAborted;
+	int numberOfSolutions = aborted != NotAborted ? SolveAborted : found > INT_MAX ? INT_MAX : (int)found;
+	if (options.stats) {
+		options.stats->nodes = state.nodes;
+		options.stats->solutions = found;
+		options.stats->aborted = aborted;
+	}
+
+
+	bool filled = aborted != NotAborted ? found > 0 : numberOfSolutions == 1 || (options.mode == FindAny && numberOfSolutions > 0);
+	const std::vector<int>& values = filled ? state.solution : data.v;
+	CellSpan grid = s.all();
+	for (int cell = 0; cell < g.cells; cell++) {
+		grid[cell] = (CellValue)values[cell];
+	}
+	state.solution.swap(arena.solution);
+	return numberOfSolutions;
+}
+
+// Put the box, row and column of a cell whose possibilities have changed on the worklist, in the bucket for the number of
+// digits now placed in each
+template <class G>
+static void touchCell(SolveData& sd, const G& g, int cell) {
+	int box = g.box(cell);
+	int x = cell / g.size;
+	int y = cell % g.size;
+	if (g.size <= DirtyMaskSize) {
+		sd.dirtyUnits |= (1ULL << box) | (1ULL << (g.size + y)) | (1ULL << (2 * g.size + x));
+		return;
+	}
+	sd.dirty.push(box, countDigits(sd.b[box]));
+	sd.dirty.push(g.size + y, countDigits(sd.r[y]));
+	sd.dirty.push(2 * g.size + x, countDigits(sd.c[x]));
+}
+
+// Add (or with remove set, take away) a cell from the positions of some digits in its box, row and column
+template <class G>
+static void updatePositions(SolveData& sd, const G& g, int cell, DigitMask digits, bool remove) {
+	int x = cell / g.size;
+	int y = cell % g.size;
+	DigitMask* boxPositions = sd.positions(g.box(cell));
+	DigitMask* rowPositions = sd.positions(g.size + y);
+	DigitMask* columnPositions = sd.positions(2 * g.size + x);
+	DigitMask boxBit = 1ULL << g.boxPosition(cell);
+	DigitMask rowBit = 1ULL << x;
+	DigitMask columnBit = 1ULL << y;
+	for (DigitMask m = digits; m; m &= m - 1) {
+		int d = lowestBit(m);
+		if (remove) {
+			boxPositions[d] &= ~boxBit;
+			rowPositions[d] &= ~rowBit;
+			columnPositions[d] &= ~columnBit;
+		}
+		else {
+			boxPositions[d] |= boxBit;
+			rowPositions[d] |= rowBit;
+			columnPositions[d] |= columnBit;
+		}
+	}
+}
+
+// Change the possibilities of a cell, recording the change on the trail and keeping the positions index up to date.
+// possible must be a subset of the cell's current possibilities.
+template <class G>
+static void setPossible(SolveData& sd, const G& g, int cell, DigitMask possible) {
+	DigitMask previous = sd.t[cell];
+	sd.trail.push_back(Change(Change::Cell, cell, previous));
+	sd.t[cell] = possible;
+	updatePositions(sd, g, cell, previous & ~possible, true);
+	sd.candidates.move(cell, countDigits(possible));
+}
+
+// Keep only the digits in allowed as possibilities of a cell, solving it if just one is left.
+// Returns -1 if no digit would be left, otherwise whether any digit was removed.
+template <class G>
+static int restrictCell(SolveData& sd, const G& g, int cell, DigitMask allowed) {
+	DigitMask possible = sd.t[cell];
+	if (!(possible & ~allowed)) return 0;
+	if (!(possible & allowed)) return -1;
+	possible &= allowed;
+	setPossible(sd, g, cell, possible);
+	touchCell(sd, g, cell);
+	if (!(possible & (possible - 1)) && !resolve(sd, g, cell, lowestDigit(possible))) return -1;
+	return 1;
+}
+
+// Remove a digit from the possibilities of a cell.
+// Returns -1 if it was the only digit left, otherwise whether the digit was still possible.
+template <class G>
+static int eliminate(SolveData& sd, const G& g, int cell, DigitMask digit) {
+	return restrictCell(sd, g, cell, ~digit);
+}
+
+// Digits already placed in unit u
+template <class G>
+static DigitMask placedDigits(const SolveData& sd, const G& g, int u) {
+	if (u < g.size) return sd.b[u];
+	if (u < 2 * g.size) return sd.r[u - g.size];
+	return sd.c[u - 2 * g.size];
+}
+
+// Rule 2a for one unit. Counting how many of its cells may hold each digit finds the digits with nowhere left to go and
+// the digits with just one cell left without looking at the digits one by one. The counts may be older than the last
+// changes to the unit, as cells only ever lose digits: a digit counted with no cells still has none and a digit counted
+// with one cell has at most that one left, so nothing is placed wrongly, though newer singles wait for a recount.
+// Returns -1 if a digit has nowhere left to go, otherwise the number of digits placed.
+template <class G>
+static int placeHiddenSingles(SolveData& sd, const G& g, int u, const DigitCounts& counts) {
+	const CellIndex* unit = g.unit(u);
+	DigitMask missing = sd.all & ~placedDigits(sd, g, u);
+	if (counts.none(sd.all) & missing) return -1;
+
+	int placed = 0;
+	const DigitMask* positions = sd.positions(u);
+	for (DigitMask singles = counts.once() & missing; singles; singles &= singles - 1) {
+		// Placing an earlier single may have placed this digit too or taken its last cell since it was counted
+		int d = lowestDigit(singles);
+		if (placedDigits(sd, g, u) & digitBit(d)) continue;
+		DigitMask possibleCells = positions[d - 1];
+		if (!possibleCells || !resolve(sd, g, unit[lowestBit(possibleCells)], d)) return -1;
+		placed++;
+	}
+	return placed;
+}
+
+template <class G>
+static int placeHiddenSingles(SolveData& sd, const G& g, int u) {
+	DigitCounts counts;
+	sd.countDigits(sd.t.data(), g.unit(u), 1, g.size, &counts);
+	return placeHiddenSingles(sd, g, u, counts);
+}
+
+// Rule 2b - if n digits may only appear within the same n cells of a unit, no other digits may exist in those cells.
+// This finds the sets where one digit's cells hold all of the others, of any size.
+// Returns -1 if more digits than cells were found, otherwise whether any possibilities were removed.
+template <class G>
+static int applySharedDigits(SolveData& sd, const G& g, int u, int d) {
+	const CellIndex* unit = g.unit(u);
+	const DigitMask* positions = sd.positions(u);
+	DigitMask placed = placedDigits(sd, g, u);
+	DigitMask possibleCells = positions[d - 1];
+	int numberOfCells = countDigits(possibleCells);
+	if (numberOfCells < 2 || (placed & digitBit(d))) return 0;
+
+	// Any digit whose cells are a subset of this digit's cells shares the region
+	DigitMask sharedDigits = 0;
+	for (DigitMask m = sd.all & ~placed; m; m &= m - 1) {
+		int d2 = lowestBit(m);
+		if (!(positions[d2] & ~possibleCells)) sharedDigits |= 1ULL << d2;
+	}
+	int numberOfDigits = countDigits(sharedDigits);
+	if (numberOfDigits > numberOfCells) {
+		// More digits than cells to put them in
+		return -1;
+	}
+	bool progressMade = false;
+	if (numberOfDigits == numberOfCells) {
+		for (DigitMask m = possibleCells; m; m &= m - 1) {
+			int cell = unit[lowestBit(m)];
+			if (sd.v[cell] > 0) continue;
+			int restricted = restrictCell(sd, g, cell, sharedDigits);
+			if (restricted < 0) return -1;
+			if (restricted) progressMade = true;
+		}
+	}
+	return progressMade;
+}
+
+// Rule 2c - if the cells of a unit that may hold a digit all lie in one other unit as well, the digit can't appear
+// anywhere else in that other unit. For a box this is a digit pointing along a row or column, for a row or column a digit
+// claimed by a box. Each crossing unit's shared cells come from the intersection tables of the geometry, so finding the
+// cells to clear takes a few mask operations per intersection rather than a look at every cell.
+// Only cells outside unit u are changed. Returns -1 if a cell was left with no digit, otherwise whether any possibilities
+// were removed.
+template <class G>
+static int applyLockedCandidates(SolveData& sd, const G& g, int u) {
+	const Intersection* intersections = g.intersections(u);
+	int numberOfIntersections = g.intersectionCount(u);
+	bool progressMade = false;
+	for (DigitMask m = sd.all & ~placedDigits(sd, g, u); m; m &= m - 1) {
+		int d = lowestBit(m);
+		// Bit k is the k-th cell of the unit. A single cell is left to rule 2a.
+		DigitMask possibleCells = sd.positions(u)[d];
+		if (!(possibleCells & (possibleCells - 1))) continue;
+
+		for (int i = 0; i < numberOfIntersections; i++) {
+			const Intersection& intersection = intersections[i];
+			if (possibleCells & ~intersection.cells) continue;
+
+			// The intersections of a unit don't overlap, so no other one can hold every cell either
+			DigitMask outside = sd.positions(intersection.other)[d] & ~intersection.otherCells;
+			const CellIndex* other = g.unit(intersection.other);
+			for (; outside; outside &= outside - 1) {
+				if (eliminate(sd, g, other[lowestBit(outside)], 1ULL << d) < 0) return -1;
+				progressMade = true;
+			}
+			break;
+		}
+	}
+	return progressMade;
+}
+
+// Rules 2a and 2b for one box, row or column
+// Returns -1 if something was invalid, otherwise whether any possibilities were removed.
+template <class G>
+static int applyUnitRules(SolveData& sd, const G& g, int u) {
+	const CellIndex* unit = g.unit(u);
+	const DigitMask* positions = sd.positions(u);
+	bool progressMade = false;
+	for (int d = 1; d < g.size + 1; d++) {
+		if (placedDigits(sd, g, u) & digitBit(d)) continue;
+
+		// Bit k is the k-th cell of the unit
+		DigitMask possibleCells = positions[d - 1];
+		int numberOfCells = countDigits(possibleCells);
+		if (numberOfCells == 0) {
+			// Something was invalid
+			return -1;
+		}
+		if (numberOfCells == 1) {
+			if (!resolve(sd, g, unit[lowestBit(possibleCells)], d)) return -1;
+			progressMade = true;
+			continue;
+		}
+
+		// Rule 2b
+		int shared = applySharedDigits(sd, g, u, d);
+		if (shared < 0) return -1;
+		if (shared) progressMade = true;
+	}
+	return progressMade;
+}
+
+// Items of one unit searched for a subset: its cells with their possible digits for a naked subset, or its digits with
+// their possible cells for a hidden subset. Either way a subset is n items that between them have only n bits set.
+struct SubsetSearch {
+	DigitMask unitMasks[64]; // mask of every item of the unit, 0 for items that are already solved or placed
+	DigitMask masks[64]; // masks of the items that may be part of a subset
+	int items[64]; // which item each of those is
+	int count;
+	int size; // items in the unit
+	int maxSize; // largest subset to look for
+	DigitMask subsetBits; // union of the masks of the subset found
+	DigitMask subsetItems; // items in the subset found
+};
+
+// Look for a subset by adding items from masks[start] onwards to the items chosen so far, whose masks have bits between
+// them. A subset is only returned if another item of the unit shares one of its bits, so it removes something, or if
+// it has fewer bits than items, which is a contradiction. Returns the number of items in the subset, 0 if there is none.
+static int findSubset(SubsetSearch& search, int start, int chosen, DigitMask bits, DigitMask items) {
+	for (int i = start; i < search.count; i++) {
+		DigitMask newBits = bits | search.masks[i];
+		int numberOfBits = countDigits(newBits);
+		// Adding more items never removes bits, so nothing below this item can be a subset
+		if (numberOfBits > search.maxSize) continue;
+
+		DigitMask newItems = items | (1ULL << search.items[i]);
+		if (numberOfBits <= chosen + 1) {
+			bool useful = numberOfBits < chosen + 1;
+			for (int k = 0; k < search.size && !useful; k++) {
+				if (!(newItems & (1ULL << k)) && (search.unitMasks[k] & newBits)) useful = true;
+			}
+			if (useful) {
+				search.subsetBits = newBits;
+				search.subsetItems = newItems;
+				return chosen + 1;
+			}
+		}
+		if (chosen + 1 < search.maxSize) {
+			int found = findSubset(search, i + 1, chosen + 1, newBits, newItems);
+			if (found) return found;
+		}
+	}
+	return 0;
+}
+
+// Set up a search over the items of a unit with the given masks (0 for items to leave out), looking for subsets of 2 up
+// to maxSize items. Returns false if no subset small enough to be any use is possible.
+static bool startSubsetSearch(SubsetSearch& search, const DigitMask* masks, int size, int maxSize) {
+	search.count = 0;
+	search.size = size;
+	int remaining = 0;
+	for (int k = 0; k < size; k++) {
+		search.unitMasks[k] = masks[k];
+		if (!masks[k]) continue;
+		remaining++;
+		if (countDigits(masks[k]) <= maxSize) {
+			search.masks[search.count] = masks[k];
+			search.items[search.count] = k;
+			search.count++;
+		}
+	}
+
+	// A subset of every remaining item is no use, so look for one at least an item smaller
+	search.maxSize = maxSize < remaining - 1 ? maxSize : remaining - 1;
+	return search.maxSize >= 2;
+}
+
+// Rule 3 - if there are any n cells in a unit that each have a subset of the same n digits, those cells must contain
+// those digits so they can be eliminated from the rest of the unit. Subsets of 2 up to sd.subsetSize cells are looked for.
+// Returns -1 if n cells share fewer than n digits, otherwise whether any possibilities were removed.
+template <class G>
+static int applyNakedSubsets(SolveData& sd, const G& g, int u) {
+	if (sd.subsetSize < 2) return 0;
+	const CellIndex* unit = g.unit(u);
+
+	DigitMask masks[64];
+	for (int k = 0; k < g.size; k++) {
+		masks[k] = sd.v[unit[k]] > 0 ? 0 : sd.t[unit[k]];
+	}
+	SubsetSearch search;
+	if (!startSubsetSearch(search, masks, g.size, sd.subsetSize)) return 0;
+
+	int n = findSubset(search, 0, 0, 0, 0);
+	if (n == 0) return 0;
+	if (countDigits(search.subsetBits) < n) return -1;
+
+	bool progressMade = false;
+	for (int k = 0; k < g.size; k++) {
+		if ((search.subsetItems & (1ULL << k)) || !masks[k]) continue;
+		int restricted = restrictCell(sd, g, unit[k], ~search.subsetBits);
+		if (restricted < 0) return -1;
+		if (restricted) progressMade = true;
+	}
+	return progressMade;
+}
+
+// Rule 2b in full - if any n digits may only appear in the same n cells of a unit, those cells can't hold any other
+// digit. Found by combining the positions of 2 up to sd.subsetSize digits, whichever order they come in.
+// Returns -1 if n digits have fewer than n cells between them, otherwise whether any possibilities were removed.
+template <class G>
+static int applyHiddenSubsets(SolveData& sd, const G& g, int u) {
+	// Either digit of a hidden pair has the cells of both, so applySharedDigits has found every pair already
+	if (sd.subsetSize < 3) return 0;
+	const CellIndex* unit = g.unit(u);
+
+	DigitMask masks[64];
+	const DigitMask* positions = sd.positions(u);
+	DigitMask placed = placedDigits(sd, g, u);
+	for (int d = 0; d < g.size; d++) {
+		masks[d] = (placed & (1ULL << d)) ? 0 : positions[d];
+	}
+	SubsetSearch search;
+	if (!startSubsetSearch(search, masks, g.size, sd.subsetSize)) return 0;
+
+	int n = findSubset(search, 0, 0, 0, 0);
+	if (n == 0) return 0;
+	if (countDigits(search.subsetBits) < n) return -1;
+
+	bool progressMade = false;
+	for (DigitMask m = search.subsetBits; m; m &= m - 1) {
+		int restricted = restrictCell(sd, g, unit[lowestBit(m)], search.subsetItems);
+		if (restricted < 0) return -1;
+		if (restricted) progressMade = true;
+	}
+	return progressMade;
 }
 
-int recursiveSolve(Sudoku& s, SolveData& sd) {
+// The rules after rule 2a for one box, row or column, the cheapest first. Each rule after the first only runs once the
+// ones before it find nothing more, as the unit is looked at again after anything they change.
+// Returns -1 if something was invalid.
+template <class G>
+static int applyHarderRules(SolveData& sd, const G& g, int u) {
+	// Rule 2c only changes other units, so this unit still needs the rest
+	if (applyLockedCandidates(sd, g, u) < 0) return -1;
+
+	int result = applyUnitRules(sd, g, u);
+	if (result) return result;
+
+	// Rule 3 and the rest of rule 2b last, as they are the most expensive
+	result = applyNakedSubsets(sd, g, u);
+	if (result) return result;
+
+	return applyHiddenSubsets(sd, g, u);
+}
+
+template <class G>
+bool applyRules(SolveData& sd, const G& g) {
 
 	/*std::ofstream f("possibilitytable.txt");
 
-	for (int x = 0; x < s.size; x++) {
-		for (int y = 0; y < s.size; y++) {
+	for (int x = 0; x < g.size; x++) {
+		for (int y = 0; y < g.size; y++) {
 			f << x << " " << y << " : ";
-			for (int d = 1; d < s.size+1; d++) {
-				if (sd.t[x][y][d] == true) {
+			for (int d = 1; d < g.size+1; d++) {
+				if (sd.t[x * g.size + y] & digitBit(d)) {
 					f << d << " ";
 				}
 			}
@@ -150,8 +596,8 @@ int recursiveSolve(Sudoku& s, SolveData& sd) {
 	}
 
 	f << std::endl << "Rows" << std::endl;
-	for (int y = 0; y < s.size; y++) {
-		if (sd.r[y][0]) {
+	for (int y = 0; y < g.size; y++) {
+		if (sd.r[y] == sd.all) {
 			f << "True" << std::endl;
 		}
 		else {
@@ -161,531 +607,521 @@ int recursiveSolve(Sudoku& s, SolveData& sd) {
 
 	f.close();*/
 
-	bool progressMade;
-
-	do {
-		progressMade = false;
-
-
-
-		// Rule 2
-
-
-		// Apply to Boxes
-		for (int a = 0; a < s.boxHeight; a++) {
-			for (int b = 0; b < s.boxWidth; b++) {
-				if (sd.b[a][b][0] == false) {
-					for (int d = 1; d < s.size + 1; d++) {
-						if (sd.b[a][b][d] == false) {
-							std::vector<xy> possibleCells;
-							for (int x = a * s.boxWidth; x < (a + 1) * s.boxWidth; x++) {
-								for (int y = b * s.boxHeight; y < (b + 1) * s.boxHeight; y++) {
-									if (!sd.t[x][y][0] && sd.t[x][y][d]) {
-										possibleCells.push_back(xy(x, y));
-									}
-								}
-							}
-							if (possibleCells.size() == 1) {								
-								resolve(s, sd, possibleCells[0].x, possibleCells[0].y, d);
-								progressMade = true;
-							}
-							else {
-
-								if (possibleCells.size() == 0) {
-									// Something was invalid
-									return 0;
-								}
-
-								bool sharedColumn = true;
-								int columnNumber = possibleCells[0].x;
-								for (int cellNum = 1; cellNum < possibleCells.size(); cellNum++) {
-									if (columnNumber != possibleCells[cellNum].x) {
-										sharedColumn = false;
-										break;
-									}
-								}
-								if (sharedColumn) {
-									// possibleCells will be from left to right and top to bottom
-									for (int i = 0; i < s.size; i++) {
-										if (i < possibleCells[0].y || i > possibleCells.back().y) {
-											sd.t[columnNumber][i][d] = false;
-											if (check(s, sd, columnNumber, i)) progressMade = true;
-										}
-									}
-								}
-								else {
-
-									bool sharedRow = true;
-									int rowNumber = possibleCells[0].y;
-									for (int cellNum = 1; cellNum < possibleCells.size(); cellNum++) {
-										if (rowNumber != possibleCells[cellNum].y) {
-											sharedRow = false;
-											break;
-										}
-									}
-									if (sharedRow) {
-										// possibleCells will be from left to right and top to bottom
-										for (int i = 0; i < s.size; i++) {
-											if (i < possibleCells[0].x || i > possibleCells.back().x) {
-												sd.t[i][rowNumber][d] = false;
-												if (check(s, sd, i, rowNumber)) progressMade = true;
-											}
-										}
-									}
-								}
-
-								//Rule 2b - boxes
-								for (int d2 = 1; d2 < s.size + 1; d2++) {
-									if (sd.b[a][b][d2] == true) continue;
-									std::vector<int> sharedDigits = { d };
-									if (d != d2) {
-										bool sharedRegion = true;
-										std::vector<xy>::iterator it;
-										it = possibleCells.begin();
-										for (int bx = a * s.boxWidth; bx < (a + 1) * s.boxWidth; bx++) {
-											for (int by = b * s.boxHeight; by < (b + 1) * s.boxHeight; by++) {
-												if (sd.t[bx][by][0] == false && sd.t[bx][by][d2] == true) {
-													bool cellInRegion = false;
-													while (it != possibleCells.end()) {
-														if (it->x == bx && it->y == by) {
-															cellInRegion = true;
-															break; // Cell appeared, move on
-														}
-														else {
-															++it;
-														}
-													}
-													if (!cellInRegion) {
-														sharedRegion = false;
-														break;
-													}
-												}
-											}
-										}
-										if (sharedRegion) {
-											sharedDigits.push_back(d2);
-											if (sharedDigits.size() == possibleCells.size()) {
-												// n sized region of n different digits has been found. No other digits may exist in this region
-												std::vector<int>::iterator it;
-												it = sharedDigits.begin();
-												for (int digit = 1; digit < s.size + 1; digit++) {
-													bool digitAllowed = false;
-													for (int& allowedDigit : sharedDigits) {
-														if (allowedDigit == digit) {
-															digitAllowed = true;
-															break;
-														}
-													}
-													if (!digitAllowed) {
-														for (xy& cell : possibleCells) {
-															sd.t[cell.x][cell.y][digit] = false;
-														}
-													}
-												}
-												for (xy& cell : possibleCells) {
-													if (check(s, sd, cell.x, cell.y)) progressMade = true;
-												}
-												break;
-											}
-										}
-									}
-								}
-							}
-						}
-					}
+	// Solved cells only hold their own digit, which has been placed in all of their units, so any cell that may still
+	// contain a digit that has not been placed in a unit is unsolved.
+
+	// Rule 2, only for the boxes/rows/columns that have lost possibilities since they were last looked at. Rule 2a is the
+	// cheapest, so for small sudokus the other rules wait until it finds nothing more in any unit.
+	if (g.size <= DirtyMaskSize) {
+		DigitMask waiting = 0; // units rule 2a has found nothing more in, to be given the other rules
+		while (true) {
+			while (sd.dirtyUnits) {
+				// Count every dirty unit with digits left to place in one go, which lets the SIMD kernels fill their lanes
+				DigitMask counted = 0;
+				for (DigitMask m = sd.dirtyUnits; m; m &= m - 1) {
+					int u = lowestBit(m);
+					if (placedDigits(sd, g, u) != sd.all) counted |= 1ULL << u;
+				}
+				sd.dirtyUnits = 0;
+				sd.countDigits(sd.t.data(), g.unit(0), counted, g.size, sd.counts.data());
+				for (; counted; counted &= counted - 1) {
+					int u = lowestBit(counted);
+					// A unit changed since it was counted waits for the next round's count
+					if ((sd.dirtyUnits & (1ULL << u)) || placedDigits(sd, g, u) == sd.all) continue;
+					// Any cell rule 2a solves was in this unit, which is then dirty again to be counted afresh
+					int result = placeHiddenSingles(sd, g, u, sd.counts[u]);
+					if (result < 0) return false;
+					if (!result) waiting |= 1ULL << u;
 				}
 			}
+			if (!waiting) break;
+			int u = lowestBit(waiting);
+			waiting &= waiting - 1;
+			if (placedDigits(sd, g, u) == sd.all) continue;
+			if (applyHarderRules(sd, g, u) < 0) return false;
 		}
+		return true;
+	}
 
-		// Apply to Rows + Columns
-		for (int i = 0; i < s.size; i++) {
-			// Rows
-			if (sd.r[i][0] == false) {
-				for (int d = 1; d < s.size + 1; d++) {
-					if (sd.r[i][d] == false) {
-						std::vector<int> possibleCells;
-						for (int x = 0; x < s.size; x++) {
-							if (!sd.t[x][i][0] && sd.t[x][i][d]) {
-								possibleCells.push_back(x);
-							}
-						}
-						if (possibleCells.size() == 1) {
-							progressMade = true;
-							resolve(s, sd, possibleCells[0], i, d);
-						}
-						else {
-
-							if (possibleCells.size() == 0) {
-								// Something was invalid
-								return 0;
-							}
-
-							int boxX = possibleCells[0] / s.boxWidth;
-							if (possibleCells.back() / s.boxWidth == boxX) {
-								int boxY = i / s.boxHeight;
-								// possibleCells will be from left to right
-								for (int x = boxX * s.boxWidth; x < (boxX + 1) * s.boxWidth; x++) {
-									for (int y = boxY * s.boxHeight; y < (boxY + 1) * s.boxHeight; y++) {
-										if (x < possibleCells[0] || x > possibleCells.back() || y != i) {
-											sd.t[x][y][d] = false;
-											if (check(s, sd, x, y)) progressMade = true;
-										}
-									}
-								}
-							}
-							// Rule 2b - rows, I think it might be possible to ommit the rule 2b code for rows and columns and only apply it to boxes.
-							for (int d2 = 1; d2 < s.size + 1; d2++) {
-								if (sd.r[i][d2] == true) continue;
-								std::vector<int> sharedDigits = { d };
-								if (d != d2) {
-									bool sharedRegion = true;
-									std::vector<int>::iterator it;
-									it = possibleCells.begin();
-									for (int bx = 0; bx < s.size; bx++) {
-										if (sd.t[bx][i][0] == false && sd.t[bx][i][d2] == true) {
-											bool cellInRegion = false;
-											while (it != possibleCells.end()) {
-												if (*it == bx) {
-													cellInRegion = true;
-													break; // Cell appeared, move on
-												}
-												else {
-													++it;
-												}
-											}
-											if (!cellInRegion) {
-												sharedRegion = false;
-												break;
-											}
-										}
-									}
-									if (sharedRegion) {
-										sharedDigits.push_back(d2);
-										if (sharedDigits.size() == possibleCells.size()) {
-											// n sized region of n different digits has been found. No other digits may exist in this region
-											std::vector<int>::iterator it;
-											it = sharedDigits.begin();
-											for (int digit = 1; digit < s.size + 1; digit++) {
-												bool digitAllowed = false;
-												for (int& allowedDigit : sharedDigits) {
-													if (allowedDigit == digit) {
-														digitAllowed = true;
-														break;
-													}
-												}
-												if (!digitAllowed) {
-													for (int& cell : possibleCells) {
-														sd.t[cell][i][digit] = false;
-													}
-												}
-											}
-											for (int& cell : possibleCells) {
-												if (check(s, sd, cell, i)) progressMade = true;
-											}
-											break;
-										}
-									}
-								}
-							}
-						}
-					}
-				}
-			}
-			// Columns
-			if (sd.c[i][0] == false) {
-				for (int d = 1; d < s.size + 1; d++) {
-					if (sd.c[i][d] == false) {
-						std::vector<int> possibleCells;
-						for (int y = 0; y < s.size; y++) {
-							if (!sd.t[i][y][0] && sd.t[i][y][d]) {
-								possibleCells.push_back(y);
-							}
-						}
-						if (possibleCells.size() == 1) {
-							progressMade = true;
-							resolve(s, sd, i, possibleCells[0], d);
-						}
-						else {
-
-							if (possibleCells.size() == 0) {
-								// Something was invalid
-								return 0;
-							}
-
-							int boxY = possibleCells[0] / s.boxHeight;
-							if (possibleCells.back() / s.boxHeight == boxY) {
-								int boxX = i / s.boxWidth;
-								// possibleCells will be from top to bottom
-								for (int x = boxX * s.boxWidth; x < (boxX + 1) * s.boxWidth; x++) {
-									for (int y = boxY * s.boxHeight; y < (boxY + 1) * s.boxHeight; y++) {
-										if (y < possibleCells[0] || y > possibleCells.back() || x != i) {
-											sd.t[x][y][d] = false;
-											if (check(s, sd, x, y)) progressMade = true;
-										}
-									}
-								}
-
-							}
-
-							// Rule 2b - columns, I think it might be possible to ommit the rule 2b code for rows and columns and only apply it to boxes.
-							for (int d2 = 1; d2 < s.size + 1; d2++) {
-								if (sd.c[i][d2] == true) continue;
-								std::vector<int> sharedDigits = { d };
-								if (d != d2) {
-									bool sharedRegion = true;
-									std::vector<int>::iterator it;
-									it = possibleCells.begin();
-									for (int by = 0; by < s.size; by++) {
-										if (sd.t[i][by][0] == false && sd.t[i][by][d2] == true) {
-											bool cellInRegion = false;
-											while (it != possibleCells.end()) {
-												if (*it == by) {
-													cellInRegion = true;
-													break; // Cell appeared, move on
-												}
-												else {
-													++it;
-												}
-											}
-											if (!cellInRegion) {
-												sharedRegion = false;
-												break;
-											}
-										}
-									}
-									if (sharedRegion) {
-										sharedDigits.push_back(d2);
-										if (sharedDigits.size() == possibleCells.size()) {
-											// n sized region of n different digits has been found. No other digits may exist in this region
-											std::vector<int>::iterator it;
-											it = sharedDigits.begin();
-											for (int digit = 1; digit < s.size + 1; digit++) {
-												bool digitAllowed = false;
-												for (int& allowedDigit : sharedDigits) {
-													if (allowedDigit == digit) {
-														digitAllowed = true;
-														break;
-													}
-												}
-												if (!digitAllowed) {
-													for (int& cell : possibleCells) {
-														sd.t[i][cell][digit] = false;
-													}
-												}
-											}
-											for (int& cell : possibleCells) {
-												if (check(s, sd, i, cell)) progressMade = true;
-											}
-											break;
-										}
-									}
-								}
-							}
-						}
-					}
+	// Larger sudokus start with the units that have the most known cells. Anything the rules change puts the units it
+	// touches back on the worklist, so this stops once no unit has anything left to find.
+	for (int u = sd.dirty.pop(); u >= 0; u = sd.dirty.pop()) {
+		if (placedDigits(sd, g, u) == sd.all) continue;
+
+		// Any cell rule 2a solves was in this unit, which is then already back on the worklist
+		int result = placeHiddenSingles(sd, g, u);
+		if (result < 0) return false;
+		if (result) continue;
+
+		if (applyHarderRules(sd, g, u) < 0) return false;
+	}
+
+	// resolve() refuses to place a digit twice in a unit or to leave a cell with no digit, so there is nothing left to
+	// check: either every cell is solved or a guess has to be made.
+	return true;
+}
+
+const char* techniqueName(Technique technique) {
+	switch (technique) {
+	case NakedSingle: return "naked-single";
+	case HiddenSingle: return "hidden-single";
+	case LockedCandidates: return "locked-candidates";
+	case NakedSubset: return "naked-subset";
+	case HiddenSubset: return "hidden-subset";
+	case Guessing: return "guess";
+	default: return "unknown";
+	}
+}
+
+// Rule 2b for every digit of a unit, stopping at the first that removes anything
+template <class G>
+static int applySharedDigitsOnce(SolveData& sd, const G& g, int u) {
+	for (int d = 1; d < g.size + 1; d++) {
+		int result = applySharedDigits(sd, g, u, d);
+		if (result) return result;
+	}
+	return applyHiddenSubsets(sd, g, u);
+}
+
+// The rules in order of difficulty, as a person grading a sudoku would use them: a technique is only tried once every
+// simpler one has nothing left to find, and after it finds something everything starts again from the simplest. Naked
+// singles are placed by resolve() as soon as they appear, so they are always used first and are counted afterwards from
+// the cells solved. Each pass looks at every unit rather than working from sd.dirty, which is slower than applyRules()
+// but doesn't let one unit's harder rules run while an easier rule could make progress elsewhere.
+// Returns false if the rules found a contradiction.
+template <class G>
+static bool applyRulesGraded(SolveData& sd, const G& g, SolveStats& stats) {
+	typedef int (*Rule)(SolveData&, const G&, int);
+	static const Rule rules[] = {applyLockedCandidates<G>, applyNakedSubsets<G>, applySharedDigitsOnce<G>};
+	static const Technique techniques[] = {LockedCandidates, NakedSubset, HiddenSubset};
+
+	int units = 3 * g.size;
+	while (true) {
+		// Every hidden single at once, since placing one never makes another harder to find
+		long long singles = 0;
+		for (int u = 0; u < units; u++) {
+			if (placedDigits(sd, g, u) == sd.all) continue;
+			int placed = placeHiddenSingles(sd, g, u);
+			if (placed < 0) return false;
+			singles += placed;
+		}
+		if (singles) {
+			stats.uses[HiddenSingle] += singles;
+			if (stats.hardest < HiddenSingle) stats.hardest = HiddenSingle;
+			continue;
+		}
+
+		int used = -1;
+		for (int rule = 0; rule < 3 && used < 0; rule++) {
+			for (int u = 0; u < units; u++) {
+				if (placedDigits(sd, g, u) == sd.all) continue;
+				int result = rules[rule](sd, g, u);
+				if (result < 0) return false;
+				if (result) {
+					used = rule;
+					break;
 				}
 			}
 		}
+		if (used < 0) return true;
+		stats.uses[techniques[used]]++;
+		if (stats.hardest < techniques[used]) stats.hardest = techniques[used];
 	}
-	while (progressMade);
-	
-	// Check if sudoku solved;
-	bool solved = true;
-	for (int i = 0; i < s.size; i++) {
-		if (!sd.r[i][0]) {
-			solved = false;
-			break;
-		}
+}
+
+template <class G>
+static bool isSolved(const SolveData& sd, const G& g) {
+	for (int i = 0; i < g.size; i++) {
+		if (sd.r[i] != sd.all) return false;
 	}
-	if (solved) return 1;
-	else {
-		// When all else fails, try filling in a cell with a digit and see if it can then be solved
+	return true;
+}
 
-		// First check that all the clues in the sudoku meet the rules, if not a previous "guess" must have been wrong.
-		std::vector<bool> digitsFound;
-		for (int d = 0; d < s.size; d++) {
-			digitsFound.push_back(false);
-		}
-		// Check rows and columns
-		for (int i = 0; i < s.size; i++) {
-			// Rows
-			for (int x = 0; x < s.size; x++) {
+// Nodes tried between looks at the limits of a search. Reading the clock costs less than the rules do for a single node
+// even of a 4x4 sudoku, so checking this often adds next to nothing. A search then gives up within a fraction of a
+// millisecond of its deadline for a 9x9 sudoku, or about a millisecond for 25x25.
+static const long long limitCheckInterval = 32;
+
+SearchState::SearchState(const SolveOptions& options) : numberOfSolutions(0), stop(false), nodes(0), aborted(NotAborted) {
+	limit = options.solutionLimit();
+	onSolution = options.onSolution ? &options.onSolution : NULL;
+	deadline = options.deadline;
+	if (options.timeLimit.count() > 0) {
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + options.timeLimit;
+		if (end < deadline) deadline = end;
+	}
+	nodeLimit = options.nodeLimit;
+	cancel = options.cancel;
+	limited = deadline != std::chrono::steady_clock::time_point::max() || nodeLimit > 0 || cancel != NULL;
+}
 
-				for (int d = 0; d < s.size; d++) {
-					digitsFound[d] = false;
-				}
+long long SearchState::checkInterval() const {
+	if (!limited) return LLONG_MAX;
+	if (nodeLimit > 0) {
+		// Check again exactly when the node limit is reached, if no other thread adds nodes in the meantime
+		long long left = nodeLimit - nodes.load(std::memory_order_relaxed);
+		if (left < limitCheckInterval) return left > 0 ? left : 0;
+	}
+	return limitCheckInterval;
+}
 
-				if (sd.t[x][i][0]) {
-					if (!digitsFound[(long long) s.grid[x][i]-1]) {
-						digitsFound[(long long) s.grid[x][i]-1] = true;
-					}
-					else {
-						return 0;
-					}
-				}
-			}
+bool SearchState::withinLimits(long long& tried) {
+	long long total = nodes.fetch_add(tried) + tried;
+	tried = 0;
+	if (!limited) return true;
+
+	AbortReason reason = NotAborted;
+	if (cancel != NULL && cancel->cancelled()) reason = Cancelled;
+	else if (nodeLimit > 0 && total >= nodeLimit) reason = NodeLimitReached;
+	else if (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline) reason = DeadlineReached;
+	if (reason == NotAborted) return true;
+
+	// Only counts as giving up if nothing else, such as reaching the solution limit, stopped the search first
+	bool running = false;
+	if (stop.compare_exchange_strong(running, true)) aborted = reason;
+	return false;
+}
 
-			// Columns
-			for (int y = 0; y < s.size; y++) {
-				for (int d = 0; d < s.size; d++) {
-					digitsFound[d] = false;
-				}
+static void recordSolution(const SolveData& sd, SearchState& state) {
+	long long n = ++state.numberOfSolutions;
+	if (state.limit > 0 && n > state.limit) {
+		// Another thread reached the limit first
+		state.stop = true;
+		return;
+	}
 
-				if (sd.t[i][y][0]) {
-					if (!digitsFound[(long long)s.grid[i][y]-1]) {
-						digitsFound[(long long)s.grid[i][y]-1] = true;
-					}
-					else {
-						return 0;
-					}
-				}
+	std::lock_guard<std::mutex> guard(state.solutionLock);
+	if (n == 1) state.solution = sd.v;
+	if (state.onSolution && !(*state.onSolution)(sd.v)) state.stop = true;
+	if (n == state.limit) state.stop = true;
+}
+
+// Of the cells with the fewest possible digits, the one with the most unsolved peers, which has the most to gain from
+// being solved
+template <class G>
+static int mostConstrainedCell(const SolveData& sd, const G& g, int fewest) {
+	int best = -1;
+	int mostUnsolved = -1;
+	for (int cell = sd.candidates.head[fewest]; cell >= 0; cell = sd.candidates.next[cell]) {
+		const CellIndex* peers = g.peers(cell);
+		int unsolved = 0;
+		for (int p = 0; p < g.peerCount; p++) {
+			if (sd.v[peers[p]] <= 0) unsolved++;
+		}
+		if (unsolved > mostUnsolved) {
+			best = cell;
+			mostUnsolved = unsolved;
+		}
+	}
+	return best;
+}
+
+// Pick what to guess using sd.heuristic. Returns false if there is nothing left to guess.
+template <class G>
+static bool pickGuess(const SolveData& sd, const G& g, Guess& guess) {
+	int fewest = sd.candidates.fewest();
+	if (fewest == 0) return false;
+
+	guess.cell = sd.heuristic == MostConstrainedPeers ? mostConstrainedCell(sd, g, fewest) : sd.candidates.head[fewest];
+	guess.unit = -1;
+	guess.digit = 0;
+	guess.remaining = sd.t[guess.cell];
+
+	// Rule 2a has placed every digit with a single cell left, so no digit can have fewer than two
+	if (sd.heuristic == FewestPositions && fewest > 2) {
+		for (int u = 0; u < 3 * g.size; u++) {
+			const DigitMask* positions = sd.positions(u);
+			for (DigitMask m = sd.all & ~placedDigits(sd, g, u); m; m &= m - 1) {
+				int d = lowestBit(m);
+				if (countDigits(positions[d]) >= fewest) continue;
+				fewest = countDigits(positions[d]);
+				guess.cell = -1;
+				guess.unit = u;
+				guess.digit = d + 1;
+				guess.remaining = positions[d];
+				if (fewest == 2) return true;
 			}
 		}
+	}
+	return true;
+}
 
-		// Check Boxes;
-		for (int a = 0; a < s.boxHeight; a++) {
-			for (int b = 0; b < s.boxWidth; b++) {
-				for (int d = 0; d < s.size; d++) {
-					digitsFound[d] = false;
-				}
+// Take the next choice of a guess. Returns false if it breaks the rules straight away.
+template <class G>
+static bool tryNext(SolveData& sd, const G& g, Guess& guess) {
+	int k = lowestBit(guess.remaining);
+	guess.remaining &= guess.remaining - 1;
+	if (guess.cell >= 0) return resolve(sd, g, guess.cell, k + 1);
+	return resolve(sd, g, g.unit(guess.unit)[k], guess.digit);
+}
 
-				for (int x = a * s.boxWidth; x < (a + 1) * s.boxWidth; x++) {
-					for (int y = b * s.boxHeight; y < (b + 1) * s.boxHeight; y++) {
-						if (sd.t[x][y][0]) {
-							if (!digitsFound[(long long) s.grid[x][y]-1]) {
-								digitsFound[(long long) s.grid[x][y]-1] = true;
-							}
-							else {
-								return 0;
-							}
-						}
-					}
-				}
+template <class G>
+void searchSolve(SolveData& sd, const G& g, SearchState& state) {
+	// When all else fails, try filling in a cell with a digit and see if it can then be solved. Rather than copying the sudoku
+	// for every guess, each guess remembers where the trail was so a wrong guess can be undone by rolling the trail back.
+	size_t rootMark = sd.trail.size();
+	std::vector<Guess>& guesses = sd.guesses;
+	guesses.clear();
+	long long nodes = 0; // tried since the limits were last checked
+	long long nextCheck = state.checkInterval();
+
+	bool valid = applyRules(sd, g);
+	while (!state.stop) {
+		if (valid) {
+			Guess guess;
+			if (isSolved(sd, g)) {
+				recordSolution(sd, state);
+				if (state.stop) break;
 			}
-		}
-		
-		// Copy sudoku and solve data
-		Sudoku s2 = s;
-		SolveData sd2 = sd;
-
-		// Pick the first cell with the lowest number of possibilites and start from there.
-		for (int numberOfPossibilities = 2; numberOfPossibilities < s.size; numberOfPossibilities++) {
-			for (int x = 0; x < s.size; x++) {
-				for (int y = 0; y < s.size; y++) {
-					if (!sd.t[x][y][0]) {
-						int numPosDigits = 0;
-						for (int d = 1; d < s.size + 1; d++) {
-							if (sd.t[x][y][d]) numPosDigits++;
-						}
-						if (numPosDigits == numberOfPossibilities) {
-							int numberOfSolutions = 0;
-							Sudoku solution = s;
-							for (int d = 1; d < s.size + 1; d++) {
-								if (sd.t[x][y][d]){									
-									resolve(s2, sd2, x, y, d);
-									int solutions = recursiveSolve(s2, sd2);
-									numberOfSolutions += solutions;
-									if (solutions == 1) {
-										solution = s2;
-									}
-									s2 = s;
-									sd2 = sd;
-
-									if (numberOfSolutions > 1) {
-										return 2;
-									}
-								}
-							}
-							if (numberOfSolutions == 1) {
-								s = solution;
-							}
-							return numberOfSolutions;
-						}
-					}
-				}
+			else if (pickGuess(sd, g, guess)) {
+				guess.mark = sd.trail.size();
+				guesses.push_back(guess);
 			}
 		}
+
+		// Try the next digit of the most recent guess that still has digits left
+		while (!guesses.empty() && !guesses.back().remaining) {
+			guesses.pop_back();
+		}
+		if (guesses.empty()) break;
+		if (nodes == nextCheck) {
+			if (!state.withinLimits(nodes)) break;
+			nextCheck = state.checkInterval();
+		}
+
+		Guess& guess = guesses.back();
+		rollback(sd, g, guess.mark);
+		valid = tryNext(sd, g, guess) && applyRules(sd, g);
+		nodes++;
 	}
-	return 0;
-}
 
+	rollback(sd, g, rootMark);
+	state.nodes += nodes;
+}
 
+// Make the guesses down to splitDepth on this thread, every sudoku at that depth is kept as a subtree for the workers.
+template <class G>
+static void collectSubtrees(SolveData& sd, const G& g, SearchState& state, int depth, int splitDepth, std::vector<SolveData>& subtrees) {
+	if (state.stop || !applyRules(sd, g)) return;
+	if (isSolved(sd, g)) {
+		recordSolution(sd, state);
+		return;
+	}
+	if (depth == splitDepth) {
+		subtrees.push_back(sd.branch());
+		return;
+	}
 
+	Guess guess;
+	if (!pickGuess(sd, g, guess)) return;
+	guess.mark = sd.trail.size();
+	while (guess.remaining) {
+		long long tried = 0;
+		if (state.limited && !state.withinLimits(tried)) return;
+		state.nodes++;
+		if (tryNext(sd, g, guess)) collectSubtrees(sd, g, state, depth + 1, splitDepth, subtrees);
+		rollback(sd, g, guess.mark);
+	}
+}
 
-bool check(Sudoku& s, SolveData& sd, int& x, int& y) {
-	// Check if the cell has already been resolved
-	if (sd.t[x][y][0]) return 0;
+// Threads kept between parallel searches, so solving many puzzles with several threads each doesn't start and join
+// threads for every puzzle, and the helpers keep their thread's scratch memory from one search to the next. The pool
+// grows to the most helpers any search has asked for and is never destroyed, like SolveExecutor::shared().
+class SearchHelpers {
+public:
+	static SearchHelpers& shared() {
+		static SearchHelpers* helpers = new SearchHelpers();
+		return *helpers;
+	}
 
-	// Check if only one possibility is true so the cell can be resolved.
-	int value = -1;
-	bool found = false;
-	bool update = false;
-	for (int p = 1; p-1 < s.size; p++) {
-		if (sd.t[x][y][p]) {
-			if (!found) {
-				value = p;
-				update = true;
-				found = true;
+	// Run work on the calling thread and on up to helpers threads of the pool. Helpers still busy with another search
+	// don't hold this one up: once work returns on the calling thread, any request no helper has taken yet is withdrawn
+	// and only the helpers already running work are waited for.
+	void run(int helpers, const std::function<void()>& work) {
+		Run run;
+		run.work = &work;
+		run.running = 0;
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			while ((int)m_threads.size() < helpers) {
+				m_threads.emplace_back(&SearchHelpers::serve, this);
 			}
-			else {
-				update = false;
+			for (int i = 0; i < helpers; i++) {
+				m_queue.push_back(&run);
 			}
 		}
-	}
-	if (update) {
-		resolve(s, sd, x, y, value);
-		return 1;
-	}
-	return 0;
-}
+		if (helpers == 1) m_queueSignal.notify_one();
+		else m_queueSignal.notify_all();
 
+		work();
 
-void resolve(Sudoku& s, SolveData& sd, int& x, int& y, int& value) {
-	// Set the cell to the correct value and apply rule one
-	s.grid[x][y] = value;
-	sd.t[x][y][0] = true;
+		std::unique_lock<std::mutex> guard(m_lock);
+		m_queue.erase(std::remove(m_queue.begin(), m_queue.end(), &run), m_queue.end());
+		m_doneSignal.wait(guard, [&] { return run.running == 0; });
+	}
 
-	// Update box, row and column
-	bool boxSolved = true, rowSolved = true, columnSolved = true;
-	sd.b[x / s.boxWidth][y / s.boxHeight][value] = true;
-	sd.c[x][value] = true;
-	sd.r[y][value] = true;
-
-	for (int i = 1; i < s.size+1; i++) {
-		if (!sd.r[y][i]) rowSolved = false;
-		if (!sd.c[x][i]) columnSolved = false;
-		if (!sd.b[x / s.boxWidth][y / s.boxHeight][i]) boxSolved = false;
-	}
-	if (rowSolved) sd.r[y][0] = true;
-	if (columnSolved) sd.c[x][0] = true;
-	if (boxSolved) sd.b[x / s.boxWidth][y / s.boxHeight][0] = true;
-
-	// Check row
-	for (int a = 0; a < s.size; a++) {
-		if (a != x) {
-			sd.t[a][y][value] = false;
-			check(s, sd, a, y);
+private:
+	struct Run {
+		const std::function<void()>* work;
+		int running; // helpers that have taken this run and not finished it
+	};
+
+	void serve() {
+		std::unique_lock<std::mutex> guard(m_lock);
+		while (true) {
+			m_queueSignal.wait(guard, [&] { return !m_queue.empty(); });
+			Run* run = m_queue.front();
+			m_queue.pop_front();
+			run->running++;
+			guard.unlock();
+
+			(*run->work)();
+
+			guard.lock();
+			run->running--;
+			m_doneSignal.notify_all();
+		}
+	}
+
+	std::vector<std::thread> m_threads;
+	std::mutex m_lock;
+	std::condition_variable m_queueSignal; // a helper has been asked for
+	std::condition_variable m_doneSignal; // a helper has finished its share of a run
+	std::deque<Run*> m_queue; // one entry for each helper a run still wants
+};
+
+// Search one sudoku with several threads. The first few levels of guesses are made up front and the subtrees below them
+// are shared out between the calling thread and helpers from SearchHelpers, which all stop as soon as the solution limit
+// is reached.
+template <class G>
+static void searchParallel(SolveData& sd, const G& g, SearchState& state, const SolveOptions& options) {
+	size_t rootMark = sd.trail.size();
+	std::vector<SolveData> subtrees;
+	collectSubtrees(sd, g, state, 0, options.splitDepth, subtrees);
+	rollback(sd, g, rootMark);
+
+	std::atomic<size_t> nextSubtree(0);
+	auto work = [&]() {
+		while (!state.stop) {
+			size_t i = nextSubtree++;
+			if (i >= subtrees.size()) return;
+			searchSolve(subtrees[i], g, state);
 		}
+	};
+
+	// The calling thread takes a subtree as well, so more helpers than the other subtrees would have nothing to do
+	int helpers = options.threads - 1;
+	if ((size_t)helpers >= subtrees.size()) helpers = (int)subtrees.size() - 1;
+	if (helpers <= 0) {
+		work();
+		return;
 	}
+	SearchHelpers::shared().run(helpers, work);
+}
 
-	// Check column
-	for (int b = 0; b < s.size; b++) {
-		if (b != y) {
-			sd.t[x][b][value] = false;
-			check(s, sd, x, b);
+template <class G>
+void rollback(SolveData& sd, const G& g, size_t mark) {
+	// Undo changes in the reverse order they were made
+	while (sd.trail.size() > mark) {
+		Change& change = sd.trail.back();
+		switch (change.type) {
+		case Change::Cell:
+			updatePositions(sd, g, change.index, change.previous & ~sd.t[change.index], false);
+			sd.t[change.index] = change.previous;
+			sd.candidates.move(change.index, countDigits(change.previous));
+			break;
+		case Change::Box: sd.b[change.index] = change.previous; break;
+		case Change::Row: sd.r[change.index] = change.previous; break;
+		case Change::Column: sd.c[change.index] = change.previous; break;
+		case Change::Placement:
+			// Cells are only ever placed once, so this makes the cell unsolved again
+			sd.v[change.index] = (int)change.previous;
+			sd.candidates.insert(change.index, countDigits(sd.t[change.index]));
+			break;
 		}
+		sd.trail.pop_back();
 	}
+}
 
-	// Check box
-	int startX = floor(x / s.boxWidth) * s.boxWidth;
-	int startY = floor(y / s.boxHeight) * s.boxHeight;
 
-	for (int a = startX; a < startX + s.boxWidth; a++) {
-		for (int b = startY; b < startY + s.boxHeight; b++) {
-			if (x != a || y != b) {
-				sd.t[a][b][value] = false;
-				check(s, sd, a, b);
+
+
+// Cells that have been placed but whose digit hasn't been eliminated from their peers yet. The queue is kept per thread
+// so it is only allocated once, and it is always empty between calls to resolve().
+static std::vector<CellIndex>& placementQueue() {
+	thread_local std::vector<CellIndex> queue;
+	return queue;
+}
+
+// Set the cell to a digit, without applying rule one
+template <class G>
+static void place(SolveData& sd, const G& g, int cell, int value) {
+	DigitMask digit = digitBit(value);
+	sd.trail.push_back(Change(Change::Placement, cell, (DigitMask)sd.v[cell]));
+	sd.v[cell] = value;
+	setPossible(sd, g, cell, digit);
+	sd.candidates.remove(cell);
+
+	// Update box, row and column
+	int box = g.box(cell);
+	int x = cell / g.size;
+	int y = cell % g.size;
+	sd.trail.push_back(Change(Change::Box, box, sd.b[box]));
+	sd.b[box] |= digit;
+	sd.trail.push_back(Change(Change::Column, x, sd.c[x]));
+	sd.c[x] |= digit;
+	sd.trail.push_back(Change(Change::Row, y, sd.r[y]));
+	sd.r[y] |= digit;
+	touchCell(sd, g, cell);
+}
+
+template <class G>
+bool resolve(SolveData& sd, const G& g, int cell, int value) {
+	// Set the cell to the correct value and apply rule one. Peers left with a single digit are placed in turn, through a
+	// queue rather than by recursing, so each placement has its digit eliminated from its peers exactly once.
+	std::vector<CellIndex>& queue = placementQueue();
+	place(sd, g, cell, value);
+	queue.push_back((CellIndex)cell);
+
+	for (size_t next = 0; next < queue.size(); next++) {
+		int placed = queue[next];
+		DigitMask digit = sd.t[placed];
+		const CellIndex* peers = g.peers(placed);
+		for (int p = 0; p < g.peerCount; p++) {
+			int peer = peers[p];
+			DigitMask possible = sd.t[peer];
+			if (!(possible & digit)) continue;
+			if (possible == digit) {
+				// The peer holds this digit already or has no other digit left
+				queue.clear();
+				return false;
+			}
+			possible &= ~digit;
+			setPossible(sd, g, peer, possible);
+			touchCell(sd, g, peer);
+			if (!(possible & (possible - 1))) {
+				place(sd, g, peer, lowestDigit(possible));
+				queue.push_back((CellIndex)peer);
 			}
 		}
 	}
-}
\ No newline at end of file
+	queue.clear();
+	return true;
+}
+
+// Solvers specialised for the most common shapes, anything else is solved with RuntimeGeometry
+#define INSTANTIATE_SOLVER(W, H) \
+	template void searchSolve(SolveData& sd, const Geometry<W, H>& g, SearchState& state); \
+	template bool applyRules(SolveData& sd, const Geometry<W, H>& g); \
+	template bool resolve(SolveData& sd, const Geometry<W, H>& g, int cell, int value); \
+	template void rollback(SolveData& sd, const Geometry<W, H>& g, size_t mark);
+
+INSTANTIATE_SOLVER(2, 2)
+INSTANTIATE_SOLVER(2, 3)
+INSTANTIATE_SOLVER(3, 2)
+INSTANTIATE_SOLVER(3, 3)
+INSTANTIATE_SOLVER(3, 4)
+INSTANTIATE_SOLVER(4, 3)
+INSTANTIATE_SOLVER(4, 4)
+INSTANTIATE_SOLVER(5, 5)
+INSTANTIATE_SOLVER(0, 0)
@@ -1,102 +1,459 @@
 #pragma once
-#include "Graphics.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
 
-typedef std::vector<bool>** PossibilityTable;
-typedef std::vector<bool>* PossibilityArray;
+#include "Sudoku.h"
+#include "DigitCounts.h"
+#include "DigitMask.h"
+#include "Geometry.h"
 
+// A single change made to the solve data or grid, recorded so it can be undone when a guess turns out to be wrong.
+struct Change {
+	enum Type : char { Cell, Box, Row, Column, Placement };
+	Type type;
+	int index; // cell (x * size + y) or box/row/column number
+	DigitMask previous; // value before the change, for a placement the previous cell value
+
+	Change(Type t, int i, DigitMask p) {
+		type = t;
+		index = i;
+		previous = p;
+	}
+};
+
+// Sudokus up to this many digits across have few enough units to give each a bit of one mask, SolveData::dirtyUnits,
+// which applyRules works from rather than a UnitWorklist. Looking at the units in any order then costs less than keeping
+// them ordered every time a cell changes.
+const int DirtyMaskSize = 21;
+
+// Units (boxes, rows and columns numbered as in Geometry.h) waiting to be looked at by applyRules, nearest to complete
+// first. Each unit is queued at most once, in the bucket for the number of digits placed in it. The buckets are linked
+// lists threaded through arrays, so queueing, moving and taking a unit never allocates.
+struct UnitWorklist {
+	std::vector<int> head; // first unit of each bucket, -1 if it is empty
+	std::vector<int> next; // next unit in the same bucket, -1 at the end
+	std::vector<int> previous; // previous unit in the same bucket, -1 at the start
+	std::vector<int> bucket; // bucket each unit is queued in, -1 if it isn't queued
+	int top; // no bucket above this one holds a unit
+
+	UnitWorklist() {
+		top = -1;
+	}
+
+	UnitWorklist(int size) {
+		reset(size);
+	}
+
+	// Empty the worklist, only allocating if it has never held this many units
+	void reset(int size) {
+		head.assign(size + 1, -1);
+		next.assign(3 * (size_t)size, -1);
+		previous.assign(3 * (size_t)size, -1);
+		bucket.assign(3 * (size_t)size, -1);
+		top = -1;
+	}
+
+	// Queue a unit, or move it to bucket b if it is already queued in another
+	void push(int u, int b) {
+		if (bucket[u] == b) return;
+		if (bucket[u] >= 0) remove(u);
+		bucket[u] = b;
+		previous[u] = -1;
+		next[u] = head[b];
+		if (head[b] >= 0) previous[head[b]] = u;
+		head[b] = u;
+		if (b > top) top = b;
+	}
+
+	void remove(int u) {
+		if (previous[u] >= 0) next[previous[u]] = next[u];
+		else head[bucket[u]] = next[u];
+		if (next[u] >= 0) previous[next[u]] = previous[u];
+		bucket[u] = -1;
+	}
+
+	// Take the unit from the highest bucket, -1 if there are none left
+	int pop() {
+		while (top >= 0 && head[top] < 0) top--;
+		if (top < 0) return -1;
+		int u = head[top];
+		remove(u);
+		return u;
+	}
+};
+
+// Unsolved cells grouped by how many digits they may still hold, so the search can find a cell with the fewest without
+// looking at every cell. The buckets are linked lists threaded through arrays as in UnitWorklist, with a mask of the
+// buckets that hold any cells.
+struct CandidateBuckets {
+	std::vector<int> head; // first cell of each bucket, -1 if it is empty
+	std::vector<int> next; // next cell in the same bucket, -1 at the end
+	std::vector<int> previous; // previous cell in the same bucket, -1 at the start
+	std::vector<int> bucket; // bucket each cell is in, -1 once it is solved
+	DigitMask used; // bit b - 1 is set when bucket b holds a cell
+
+	CandidateBuckets() {
+		used = 0;
+	}
+
+	CandidateBuckets(int size) {
+		reset(size);
+	}
+
+	// Every cell starts off able to hold any of the size digits. Only allocates if there have never been this many cells.
+	void reset(int size) {
+		int cells = size * size;
+		head.assign(size + 1, -1);
+		next.assign(cells, -1);
+		previous.assign(cells, -1);
+		bucket.assign(cells, -1);
+		used = 0;
+		for (int cell = cells - 1; cell >= 0; cell--) {
+			insert(cell, size);
+		}
+	}
+
+	void insert(int cell, int b) {
+		bucket[cell] = b;
+		previous[cell] = -1;
+		next[cell] = head[b];
+		if (head[b] >= 0) previous[head[b]] = cell;
+		head[b] = cell;
+		used |= 1ULL << (b - 1);
+	}
+
+	void remove(int cell) {
+		int b = bucket[cell];
+		if (previous[cell] >= 0) next[previous[cell]] = next[cell];
+		else head[b] = next[cell];
+		if (next[cell] >= 0) previous[next[cell]] = previous[cell];
+		if (head[b] < 0) used &= ~(1ULL << (b - 1));
+		bucket[cell] = -1;
+	}
+
+	// Put a cell in bucket b, if it is in one at all
+	void move(int cell, int b) {
+		if (bucket[cell] < 0 || bucket[cell] == b) return;
+		remove(cell);
+		insert(cell, b);
+	}
+
+	// Fewest digits any cell with a choice of digits may hold, 0 if there is no such cell
+	int fewest() const {
+		DigitMask choices = used & ~1ULL;
+		return choices ? lowestBit(choices) + 1 : 0;
+	}
+};
+
+// How the search picks what to guess once the rules run out
+enum BranchHeuristic {
+	FewestCandidates, // a cell with the fewest possible digits (minimum remaining values)
+	MostConstrainedPeers, // of the cells with the fewest possible digits, the one with the most unsolved peers
+	FewestPositions // as FewestCandidates, unless a digit has fewer possible cells in some unit, which are then tried in turn
+};
+
+// A guess: either a cell and the digits still to be tried there, or a digit and the cells of a unit still to be tried for
+// it. Either way exactly one of the choices is right in any solution. mark is the trail length before the guess was made.
+struct Guess {
+	int cell; // -1 when trying the cells of a unit
+	int unit;
+	int digit;
+	DigitMask remaining; // digits, or positions in the unit, still to be tried
+	size_t mark;
+};
+
+// Everything the solver knows about one sudoku. A SolveData can be reset and reused for the next sudoku, keeping the memory
+// of its tables, trail and search frames, so solving a sudoku of a shape it has seen before allocates nothing.
 struct SolveData {
 	int size; // Sudoku size
 	int boxWidth; // Sudoku Box Width
 	int boxHeight; // Sudoku Box Height
-	PossibilityTable t; // table
-	PossibilityTable b; // boxes
-	PossibilityArray r; // rows
-	PossibilityArray c; // columns
+	DigitMask all; // Every digit from 1 to size
+	std::vector<int> v; // value of each cell indexed by x * size + y, -1 if it is not known yet
+	std::vector<DigitMask> t; // table, possible digits of each cell. A solved cell holds just its own digit.
+	std::vector<DigitMask> b; // boxes, digits placed in each box
+	std::vector<DigitMask> r; // rows, digits placed in each row
+	std::vector<DigitMask> c; // columns, digits placed in each column
+	// positions, cells of each unit that may hold each digit indexed by unit * size + digit - 1. Bit k is the k-th cell of
+	// the unit. Kept up to date with every change to t, so rule 2 never has to look through the cells of a unit.
+	std::vector<DigitMask> p;
+	std::vector<Change> trail; // every change made so far, in order
+	int subsetSize; // largest naked subset looked for by rule 3 and hidden subset by rule 2b
+	UnitWorklist dirty; // units that have had possibilities removed since applyRules last looked at them
+	DigitMask dirtyUnits; // the same as a mask with bit u for unit u, used instead of dirty up to DirtyMaskSize digits
+	DigitCountKernel countDigits; // digit counting kernel for rule 2a, looked up once per solve
+	std::vector<DigitCounts> counts; // digit counts of each unit, as of when applyRules last counted it
+	CandidateBuckets candidates; // unsolved cells by number of possible digits
+	BranchHeuristic heuristic;
+	std::vector<Guess> guesses; // search frames of searchSolve, one per guess still open
 
 	SolveData() {
 		size = 0;
 		boxWidth = 0;
 		boxHeight = 0;
-		t = NULL;
-		b = NULL;
-		r = NULL;
-		c = NULL;
+		all = 0;
+		subsetSize = 0;
+		dirtyUnits = 0;
+		countDigits = digitCountKernel();
+		heuristic = FewestCandidates;
 	}
 
-	SolveData& copy(const SolveData& other) {
+	SolveData(int sz, int bW, int bH) {
+		reset(sz, bW, bH);
+	}
 
-		size = other.size;
-		boxWidth = other.boxWidth;
-		boxHeight = other.boxHeight;
+	// Start again on an empty sudoku of the given shape
+	void reset(int sz, int bW, int bH) {
+		size = sz;
+		boxWidth = bW;
+		boxHeight = bH;
+		all = allDigits(size);
+		subsetSize = 0;
+		heuristic = FewestCandidates;
+		countDigits = digitCountKernel();
 
-		t = new PossibilityArray[size];
-		for (int x = 0; x < size; x++) {
-			t[x] = new std::vector<bool>[size];
-			for (int y = 0; y < size; y++) {
-				t[x][y] = other.t[x][y];
-			}
+		// Each cell starts off unknown and able to be any digit, no digit has been placed in any box, row or column yet.
+		v.assign((size_t)size * size, -1);
+		t.assign((size_t)size * size, all);
+		b.assign(size, 0);
+		r.assign(size, 0);
+		c.assign(size, 0);
+		p.assign(3 * (size_t)size * size, all);
+		counts.resize(3 * (size_t)size);
+		trail.clear();
+		guesses.clear();
+		// Nothing has been looked at yet
+		dirty.reset(size);
+		dirtyUnits = 0;
+		for (int u = 0; u < 3 * size; u++) {
+			if (size <= DirtyMaskSize) dirtyUnits |= 1ULL << u;
+			else dirty.push(u, 0);
 		}
+		candidates.reset(size);
+	}
 
-		// Create tables for boxes, rows and colums to keep track of how many cells remain unknown.
-		// Boxes
-		b = new PossibilityArray[boxHeight];
+	DigitMask* positions(int u) { return &p[(size_t)u * size]; }
+	const DigitMask* positions(int u) const { return &p[(size_t)u * size]; }
 
-		// Number of boxes in x axis = height of boxes and number of boxes in y axis = width of boxes
-		for (int x = 0; x < boxHeight; x++) {
-			b[x] = new std::vector<bool>[boxWidth];
-			for (int y = 0; y < boxWidth; y++) {
-				b[x][y] = other.b[x][y];
-			}
-		}
+	// Copy of the current state without the trail, to start an independent search from
+	SolveData branch() const {
+		SolveData copy;
+		copy.size = size;
+		copy.boxWidth = boxWidth;
+		copy.boxHeight = boxHeight;
+		copy.all = all;
+		copy.subsetSize = subsetSize;
+		copy.heuristic = heuristic;
+		copy.v = v;
+		copy.t = t;
+		copy.b = b;
+		copy.r = r;
+		copy.c = c;
+		copy.p = p;
+		copy.dirty = dirty;
+		copy.dirtyUnits = dirtyUnits;
+		copy.countDigits = countDigits;
+		copy.counts = counts;
+		copy.candidates = candidates;
+		return copy;
+	}
+};
 
-		r = new std::vector<bool>[size];
-		c = new std::vector<bool>[size];
+// How much of the search tree Solve() has to cover. Each mode stops as soon as it has found enough solutions, so the
+// cheaper modes search less.
+enum SolveMode {
+	FindAny, // stop at the first solution
+	ProveUnique, // stop at the second solution, enough to tell one solution from many
+	CountUpTo, // stop once SolveOptions::limit solutions have been found
+	EnumerateAll // search the whole tree
+};
 
-		for (int x = 0; x < size; x++) {
-			r[x] = other.r[x];
-			c[x] = other.c[x];
-		}
+// Which solver Solve() uses
+enum SolveEngine {
+	RuleEngine, // the rules described in Solver.cpp, guessing only when they run out
+	DancingLinksEngine // exact cover with dancing links, see DancingLinks.h. Always searches on the calling thread.
+};
 
-		return *this;
-	}
+// Called with each solution as it is found, as the value of every cell indexed by x * size + y. The values are only valid
+// during the call. Return false to stop the search. Calls are never made at the same time, even when searching with
+// several threads, but they may come from any of the threads.
+typedef std::function<bool(const std::vector<int>& values)> SolutionCallback;
+
+// Solving techniques from simplest to hardest, as used to grade a sudoku
+enum Technique {
+	NakedSingle, // rule 1, a cell left with one digit once its peers' digits are ruled out
+	HiddenSingle, // rule 2a, a digit left with one cell in a unit
+	LockedCandidates, // rule 2c, a digit's cells in a box all in one row or column, or the other way round
+	NakedSubset, // rule 3, n cells of a unit with only n digits between them
+	HiddenSubset, // rule 2b, n digits of a unit with only n cells between them
+	Guessing, // none of the rules are enough
+	NumberOfTechniques
+};
+
+// Name of a technique as the command line tools print it, e.g. "hidden-single"
+const char* techniqueName(Technique technique);
+
+// Why Solve() gave up before it finished, see SolveOptions
+enum AbortReason {
+	NotAborted,
+	DeadlineReached,
+	NodeLimitReached,
+	Cancelled
+};
+
+// Returned by Solve() when it gave up before it had an answer
+const int SolveAborted = -1;
+
+// Lets another thread ask a Solve() to give up. Cancelling only sets a flag, which the search looks at every few nodes.
+class CancelToken {
+public:
+	CancelToken() : m_cancelled(false) {}
+
+	void cancel() { m_cancelled.store(true, std::memory_order_relaxed); }
+	void reset() { m_cancelled.store(false, std::memory_order_relaxed); }
+	bool cancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
 
-	SolveData& operator=(SolveData &other) {
-		copy(other);
-		return *this;
+private:
+	std::atomic<bool> m_cancelled;
+};
+
+// What a call to Solve() did
+struct SolveStats {
+	long long nodes; // guesses tried, i.e. nodes of the search tree below the root
+	long long solutions; // solutions found, also when the search gave up part way
+	AbortReason aborted;
+
+	// Only filled in when grading. uses counts each technique up to the first guess: the cells solved by each kind of
+	// single, and the number of times each of the other rules removed possibilities. The guesses are counted by nodes.
+	long long uses[NumberOfTechniques];
+	Technique hardest; // hardest technique needed, Guessing if the rules alone were not enough
+	bool guessed;
+
+	SolveStats() {
+		nodes = 0;
+		solutions = 0;
+		aborted = NotAborted;
+		for (int i = 0; i < NumberOfTechniques; i++) {
+			uses[i] = 0;
+		}
+		hardest = NakedSingle;
+		guessed = false;
 	}
+};
+
+class SolutionCache;
+
+// How Solve() should go about solving a sudoku
+struct SolveOptions {
+	SolveEngine engine;
+	SolveMode mode;
+	int limit; // number of solutions to stop at for CountUpTo
+	SolutionCallback onSolution; // optional, called for every solution found
+	int threads; // threads used to search a single sudoku, 1 searches on the calling thread
+	int splitDepth; // with more than one thread, each guess this many levels deep starts a subtree that a worker searches
+	int subsetSize; // naked and hidden subsets of 2 up to this many cells are looked for, less than 2 turns them off
+	BranchHeuristic heuristic; // what to guess when the rules run out
+	bool grade; // before guessing, only use a technique once every simpler one has nothing left to find, and fill in the
+	            // technique counts of stats. Slower than the usual order, which looks at one unit at a time.
+	SolveStats* stats; // optional, filled in once Solve() returns
+	SolutionCache* cache; // optional, answers puzzles seen before in any transformed form, see SolutionCache.h. Not used
+	                      // when grading or with onSolution.
+	// Limits on the search, which gives up and returns SolveAborted once any of them is reached. They are checked every
+	// few nodes, so the work done before the first guess always finishes, and with several threads the node limit can be
+	// overshot by a few nodes a thread.
+	std::chrono::steady_clock::time_point deadline; // time_point::max() for none
+	std::chrono::microseconds timeLimit; // counted from the call to Solve(), 0 for none
+	long long nodeLimit; // guesses that may be tried, 0 for no limit
+	const CancelToken* cancel; // optional
 
-	SolveData(SolveData& other) {
-		copy(other);
+	SolveOptions() {
+		engine = RuleEngine;
+		mode = ProveUnique;
+		limit = 2;
+		threads = 1;
+		splitDepth = 3;
+		subsetSize = 2;
+		heuristic = MostConstrainedPeers;
+		grade = false;
+		stats = NULL;
+		cache = NULL;
+		deadline = std::chrono::steady_clock::time_point::max();
+		timeLimit = std::chrono::microseconds(0);
+		nodeLimit = 0;
+		cancel = NULL;
 	}
 
-	~SolveData(){
-		if (t != nullptr) {
-			for (int x = 0; x < size; x++) {
-				delete[] t[x];
-			}
-			delete[] t;
-			t = nullptr;
-		}
-		if (b != nullptr) {
-			for (int x = 0; x < boxHeight; x++) {
-				delete[] b[x];
-			}
-			delete[] b;
-			b = nullptr;
-		}
-		if (r != nullptr) {
-			delete[] r;
-			r = nullptr;
-		}
-		if (c != nullptr) {
-			delete[] c;
-			c = nullptr;
+	// Number of solutions the search stops at, 0 for no limit
+	long long solutionLimit() const {
+		switch (mode) {
+		case FindAny: return 1;
+		case ProveUnique: return 2;
+		case CountUpTo: return limit > 0 ? limit : 1;
+		default: return 0;
 		}
 	}
 };
 
+// Shared by every search working on the same sudoku
+struct SearchState {
+	std::atomic<long long> numberOfSolutions;
+	std::atomic<bool> stop; // set once there is no need to search any further, e.g. the limit has been reached
+	std::atomic<long long> nodes; // guesses tried by every search
+	long long limit; // number of solutions to stop at, 0 for no limit
+	const SolutionCallback* onSolution;
+	std::mutex solutionLock; // held while the first solution is stored and while onSolution is called
+	std::vector<int> solution; // value of each cell in the first solution found
+
+	// The limits of SolveOptions, with the time limit turned into a deadline
+	std::chrono::steady_clock::time_point deadline;
+	long long nodeLimit;
+	const CancelToken* cancel;
+	bool limited; // there is a limit to check
+	std::atomic<int> aborted; // the AbortReason the search gave up for, only set if it stopped the search
+
+	SearchState() : numberOfSolutions(0), stop(false), nodes(0), aborted(NotAborted) {
+		limit = 2;
+		onSolution = NULL;
+		deadline = std::chrono::steady_clock::time_point::max();
+		nodeLimit = 0;
+		cancel = NULL;
+		limited = false;
+	}
+
+	SearchState(const SolveOptions& options);
+
+	// Nodes a search can try before it next has to call withinLimits
+	long long checkInterval() const;
+
+	// Add nodes tried by a search since its last call, setting nodes to 0, and check the limits. Returns false once the
+	// search should give up, having stopped every search on the sudoku and set aborted.
+	bool withinLimits(long long& nodes);
+};
+
+// Solves the sudoku in place. Returns the number of solutions found, which stops at the limit of options.mode: by default
+// 0, 1 or 2 for more than one. If exactly one solution was found, or any solution with FindAny, the grid is filled with
+// it. Otherwise the grid holds what could be worked out without guessing.
+// If the search reaches the deadline, time limit or node limit of options, or is cancelled, before it has an answer it
+// returns SolveAborted, with options.stats saying why and how far it got. The grid then holds the first solution if one
+// was found.
+// Sudokus with a box shape listed in Solver.cpp use a solver specialised for that shape, any other shape uses RuntimeGeometry.
+// Boxes can be any shape with up to MaxSudokuSize digits, a larger sudoku has no solutions.
+// Each thread keeps the memory its last solve used, so with options.threads at 1 solving another sudoku of the same shape
+// makes no heap allocations. With more threads, the calling thread is helped by threads kept between solves rather than
+// ones started for each solve.
 int Solve(Sudoku& s);
-int recursiveSolve(Sudoku& s, SolveData& sd);
+int Solve(Sudoku& s, const SolveOptions& options);
 
-bool check(Sudoku& s, SolveData& sd, int& x, int& y);
-void resolve(Sudoku& s, SolveData& sd, int& x, int& y, int& value);
\ No newline at end of file
+// The solver itself works on cell indices using the lookup tables of a Geometry.
+template <class G> void searchSolve(SolveData& sd, const G& g, SearchState& state);
+template <class G> bool applyRules(SolveData& sd, const G& g);
+// Place a digit in a cell and apply rule 1, also placing every cell that is left with a single digit. Returns false,
+// stopping straight away, if a cell is left with no digit or a digit would appear twice. The changes are then only
+// partly made and have to be rolled back.
+template <class G> bool resolve(SolveData& sd, const G& g, int cell, int value);
+// Undo every change made since the trail was mark long
+template <class G> void rollback(SolveData& sd, const G& g, size_t mark);
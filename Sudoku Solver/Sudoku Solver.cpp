@@ -5,6 +5,10 @@
 #include "Sudoku Solver.h"
 #include "Graphics.h"
 #include "Solver.h"
+#include "AsyncSolver.h"
+
+#include <algorithm>
+#include <memory>
 
 #include "CompileTimeSettings.h"
 
@@ -17,6 +21,11 @@ WCHAR szWindowClass[MAX_LOADSTRING];            // the main window class name
 
 Graphics myGraphics;
 
+// Posted once a solve started with S has finished, lParam is the SolveResult to take
+#define WM_SOLVED (WM_APP + 1)
+bool solving = false; // a solve is running, so S is ignored until it finishes
+Sudoku solvingFrom; // the grid as it was when S was pressed, so a result for a grid changed since can be dropped
+
 // Forward declarations of functions included in this code module:
 ATOM                MyRegisterClass(HINSTANCE hInstance);
 BOOL                InitInstance(HINSTANCE, int);
@@ -169,75 +178,103 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             if (!(GetKeyState(VK_CONTROL) & 0x8000)) { // If control key not pressed
                 if (wParam > 0x60 && wParam < 0x6A) {
                     int newValue = (int)wParam - 0x60;
-                    if (newValue <= SUDOKU_SIZE) {
-                        myGraphics.grid->grid[myGraphics.currentCell.x][myGraphics.currentCell.y] = newValue;
+                    if (newValue <= myGraphics.grid->size) {
+                        myGraphics.grid->at(myGraphics.currentCell.x, myGraphics.currentCell.y) = (CellValue)newValue;
                         InvalidateRect(hWnd, NULL, false);
                     }
                 }
                 else if (wParam == 0x60) {
-                    myGraphics.grid->grid[myGraphics.currentCell.x][myGraphics.currentCell.y] = -1;
+                    myGraphics.grid->at(myGraphics.currentCell.x, myGraphics.currentCell.y) = -1;
                     InvalidateRect(hWnd, NULL, false);
                 }
                 else if (wParam > 0x30 && wParam < 0x3A) {
                     int newValue = (int)wParam - 0x30;
-                    if (newValue <= SUDOKU_SIZE) {
-                        myGraphics.grid->grid[myGraphics.currentCell.x][myGraphics.currentCell.y] = newValue;
+                    if (newValue <= myGraphics.grid->size) {
+                        myGraphics.grid->at(myGraphics.currentCell.x, myGraphics.currentCell.y) = (CellValue)newValue;
                         InvalidateRect(hWnd, NULL, false);
                     }
                 }
                 else if (wParam == 0x30) {
-                    myGraphics.grid->grid[myGraphics.currentCell.x][myGraphics.currentCell.y] = -1;
+                    myGraphics.grid->at(myGraphics.currentCell.x, myGraphics.currentCell.y) = -1;
                     InvalidateRect(hWnd, NULL, false);
                 }
             }
             else {
                 if (wParam >= 0x60 && wParam < 0x6A) {
                     int newValue = 0;
-                    if (myGraphics.grid->grid[myGraphics.currentCell.x][myGraphics.currentCell.y] >= 0){
-                    newValue = myGraphics.grid->grid[myGraphics.currentCell.x][myGraphics.currentCell.y] * 10 + (int)wParam - 0x60;
+                    if (myGraphics.grid->at(myGraphics.currentCell.x, myGraphics.currentCell.y) >= 0){
+                    newValue = myGraphics.grid->at(myGraphics.currentCell.x, myGraphics.currentCell.y) * 10 + (int)wParam - 0x60;
                     }
                     else {
                         newValue = (int)wParam - 0x60;
                     }
-                    if (newValue <= SUDOKU_SIZE) {
-                        myGraphics.grid->grid[myGraphics.currentCell.x][myGraphics.currentCell.y] = newValue;
+                    if (newValue <= myGraphics.grid->size) {
+                        myGraphics.grid->at(myGraphics.currentCell.x, myGraphics.currentCell.y) = (CellValue)newValue;
                         InvalidateRect(hWnd, NULL, false);
                     }
                 }
                 else if (wParam >= 0x30 && wParam < 0x3A) {
                     int newValue = 0;
-                    if (myGraphics.grid->grid[myGraphics.currentCell.x][myGraphics.currentCell.y] >= 0) {
-                        newValue = myGraphics.grid->grid[myGraphics.currentCell.x][myGraphics.currentCell.y] * 10 + (int)wParam - 0x30;
+                    if (myGraphics.grid->at(myGraphics.currentCell.x, myGraphics.currentCell.y) >= 0) {
+                        newValue = myGraphics.grid->at(myGraphics.currentCell.x, myGraphics.currentCell.y) * 10 + (int)wParam - 0x30;
                     }
                     else {
                         newValue = (int)wParam - 0x30;
                     }
-                    if (newValue <= SUDOKU_SIZE) {
-                        myGraphics.grid->grid[myGraphics.currentCell.x][myGraphics.currentCell.y] = newValue;
+                    if (newValue <= myGraphics.grid->size) {
+                        myGraphics.grid->at(myGraphics.currentCell.x, myGraphics.currentCell.y) = (CellValue)newValue;
                         InvalidateRect(hWnd, NULL, false);
                     }
                 }
             }
 		}
 
-		if (wParam == 0x53) {
-			int numberOfSolutions = Solve(*myGraphics.grid);
-			//if (numberOfSolutions == 0){
-			//	MessageBox(hWnd, L"Invalid Sudoku Clues\nNo valid solutions.", L"Error", MB_ICONERROR);
-			//}
-			//else if (numberOfSolutions > 1) {
-			//	MessageBox(hWnd, L"Invalid Sudoku Clues\nThere are multiple valid solutions." , L"Error", MB_ICONERROR);
-			//}
-			InvalidateRect(hWnd, NULL, false);
+		if (wParam == 0x53 && !solving) {
+			// Solved in the background so the window keeps responding to messages, see WM_SOLVED
+			solving = true;
+			solvingFrom = *myGraphics.grid;
+			SolveExecutor::shared().submit(*myGraphics.grid, SolveOptions(), [hWnd](SolveResult& result) {
+				PostMessage(hWnd, WM_SOLVED, 0, (LPARAM)new SolveResult(std::move(result)));
+			});
 		}
 		else if (wParam == VK_DELETE && GetKeyState(VK_CONTROL) & 0x8000) {
-			delete myGraphics.grid;
-			myGraphics.grid = new Sudoku(BOX_WIDTH, BOX_HEIGHT);
+			myGraphics.grid->reshape(myGraphics.grid->boxWidth, myGraphics.grid->boxHeight);
 			InvalidateRect(hWnd, NULL, false);
 		}
+		else if (wParam >= VK_LEFT && wParam <= VK_DOWN && GetKeyState(VK_CONTROL) & 0x8000) {
+			// Control and the arrow keys make the boxes narrower, wider, shorter or taller, starting again on an empty grid
+			int boxWidth = myGraphics.grid->boxWidth + (wParam == VK_RIGHT) - (wParam == VK_LEFT);
+			int boxHeight = myGraphics.grid->boxHeight + (wParam == VK_DOWN) - (wParam == VK_UP);
+			if (boxWidth >= 1 && boxHeight >= 1 && boxWidth * boxHeight >= 2 && boxWidth * boxHeight <= MaxSudokuSize) {
+				myGraphics.grid->reshape(boxWidth, boxHeight);
+				myGraphics.currentCell = xy();
+				// The digits are drawn in a font sized for the grid
+				myGraphics.destroyResources();
+				InvalidateRect(hWnd, NULL, false);
+			}
+		}
 		
 		break;
 	}
+	case WM_SOLVED:
+	{
+		std::unique_ptr<SolveResult> result((SolveResult*)lParam);
+		solving = false;
+		// Cells may have been changed, or the grid cleared or reshaped, while it was being solved
+		const Sudoku& grid = *myGraphics.grid;
+		if (grid.boxWidth != solvingFrom.boxWidth || grid.boxHeight != solvingFrom.boxHeight ||
+			!std::equal(grid.all().begin(), grid.all().end(), solvingFrom.all().begin())) break;
+		*myGraphics.grid = result->sudoku;
+		InvalidateRect(hWnd, NULL, false);
+		int numberOfSolutions = result->status;
+		if (numberOfSolutions == 0){
+			MessageBox(hWnd, L"Invalid Sudoku Clues\nNo valid solutions.", L"Error", MB_ICONERROR);
+		}
+		else if (numberOfSolutions > 1) {
+			MessageBox(hWnd, L"Invalid Sudoku Clues\nThere are multiple valid solutions." , L"Error", MB_ICONERROR);
+		}
+		break;
+	}
     case WM_COMMAND:
         {
             int wmId = LOWORD(wParam);
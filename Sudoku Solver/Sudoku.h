@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sudoku grid and cell coordinates, kept free of any Windows headers so the solver can be built on its own.
+
+// Value of one cell: a digit from 1 to size, -1 for a blank cell or -2 for a cell coloured black. Sudokus are at most 64
+// digits across, so every value fits in a byte.
+typedef int8_t CellValue;
+
+// Most digits a sudoku can have, from boxes of any shape up to 8x8. A set of digits then fits in one 64 bit word.
+const int MaxSudokuSize = 64;
+
+// Contiguous run of cells, e.g. a column of a grid
+struct CellSpan {
+	CellValue* data;
+	int size;
+
+	CellValue& operator[](int i) const { return data[i]; }
+	CellValue* begin() const { return data; }
+	CellValue* end() const { return data + size; }
+};
+
+struct ConstCellSpan {
+	const CellValue* data;
+	int size;
+
+	const CellValue& operator[](int i) const { return data[i]; }
+	const CellValue* begin() const { return data; }
+	const CellValue* end() const { return data + size; }
+};
+
+// The cells are held in one buffer indexed x * size + y, column by column, the same order the solver numbers them in.
+// Copying a sudoku copies the buffer, moving it just hands the buffer over.
+struct Sudoku {
+	int size, boxWidth, boxHeight;
+
+	// An empty sudoku with no cells, to be given a shape later
+	Sudoku() {
+		size = 0;
+		boxWidth = 0;
+		boxHeight = 0;
+	}
+
+	Sudoku(int bW, int bH) {
+		reshape(bW, bH);
+	}
+
+	// Change the box shape and make every cell blank, keeping the buffer if it is big enough
+	void reshape(int bW, int bH) {
+		size = bW * bH;
+		boxWidth = bW;
+		boxHeight = bH;
+		cells.assign((size_t)size * size, -1);
+	}
+
+	CellValue& at(int x, int y) { return cells[(size_t)x * size + y]; }
+	CellValue at(int x, int y) const { return cells[(size_t)x * size + y]; }
+
+	// Cell x * size + y
+	CellValue& operator[](int cell) { return cells[cell]; }
+	CellValue operator[](int cell) const { return cells[cell]; }
+
+	// Every cell, in cell order
+	CellSpan all() { return CellSpan{ cells.data(), size * size }; }
+	ConstCellSpan all() const { return ConstCellSpan{ cells.data(), size * size }; }
+
+	// The cells (x, 0) to (x, size - 1)
+	CellSpan column(int x) { return CellSpan{ cells.data() + (size_t)x * size, size }; }
+	ConstCellSpan column(int x) const { return ConstCellSpan{ cells.data() + (size_t)x * size, size }; }
+
+private:
+	std::vector<CellValue> cells;
+};
+
+struct xy {
+	int x, y;
+	xy(int a, int b) {
+		x = a;
+		y = b;
+	}
+
+	xy() {
+		x = -1;
+		y = -1;
+	}
+};
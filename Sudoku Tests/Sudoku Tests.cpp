@@ -0,0 +1,239 @@
+// Sudoku Tests.cpp : Checks run by ctest, one per command line argument name. Each prints what went wrong and exits with
+// 1 if it fails.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "BatchSolver.h"
+#include "PuzzleText.h"
+#include "Solver.h"
+
+#ifndef _WIN32
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "SolveServer.h"
+#endif
+
+// Every digit of the largest sudoku each encoding can write survives formatPuzzle and parsePuzzle, and one more digit
+// is refused
+static bool testTextRoundTrip() {
+	struct Shape {
+		CellEncoding encoding;
+		const char* name;
+		int boxWidth, boxHeight; // largest shape the encoding can write
+		int tooBigWidth, tooBigHeight; // one with a digit more
+	};
+	static const Shape shapes[] = {
+		{ DigitEncoding, "digits", 7, 5, 6, 6 },
+		{ DigitEncoding, "digits", 35, 1, 36, 1 },
+		{ HexEncoding, "hex", 4, 4, 17, 1 },
+		{ AlphabeticEncoding, "alpha", 13, 2, 9, 3 }
+	};
+
+	bool passed = true;
+	for (const Shape& shape : shapes) {
+		Sudoku s(shape.boxWidth, shape.boxHeight);
+		if (s.size != largestDigit(shape.encoding)) {
+			printf("%s: largestDigit is %d, expected %d\n", shape.name, largestDigit(shape.encoding), s.size);
+			passed = false;
+		}
+		// Every digit in every row, with a blank cell in each row as well
+		for (int x = 0; x < s.size; x++) {
+			for (int y = 0; y < s.size; y++) {
+				s.at(x, y) = (CellValue)(x == y ? -1 : (x + y) % s.size + 1);
+			}
+		}
+
+		std::vector<char> line((size_t)s.size * s.size);
+		size_t n = formatPuzzle(s, shape.encoding, line.data());
+		Sudoku parsed(shape.boxWidth, shape.boxHeight);
+		if (n != line.size() || !parsePuzzle(line.data(), n, shape.encoding, parsed)) {
+			printf("%s %dx%d: the formatted puzzle doesn't parse\n", shape.name, shape.boxWidth, shape.boxHeight);
+			passed = false;
+			continue;
+		}
+		CellSpan cells = s.all(), parsedCells = parsed.all();
+		if (memcmp(cells.data, parsedCells.data, cells.size) != 0) {
+			printf("%s %dx%d: the parsed puzzle is different\n", shape.name, shape.boxWidth, shape.boxHeight);
+			passed = false;
+		}
+
+		Sudoku tooBig(shape.tooBigWidth, shape.tooBigHeight);
+		tooBig.at(0, 0) = (CellValue)tooBig.size;
+		line.resize((size_t)tooBig.size * tooBig.size);
+		if (formatPuzzle(tooBig, shape.encoding, line.data()) != 0) {
+			printf("%s %dx%d: the digit %d was written\n", shape.name, shape.tooBigWidth, shape.tooBigHeight, tooBig.size);
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+// A given larger than any digit of the sudoku makes it invalid, whichever engine solves it
+static bool testGivenPastLargestDigit() {
+	static const SolveEngine engines[] = { RuleEngine, DancingLinksEngine };
+	static const char* const engineNames[] = { "rules", "dlx" };
+
+	bool passed = true;
+	for (int e = 0; e < (int)(sizeof(engines) / sizeof(engines[0])); e++) {
+		for (int value = 10; value <= 127; value++) {
+			Sudoku s(3, 3);
+			s.at(4, 4) = (CellValue)value;
+			SolveOptions options;
+			options.engine = engines[e];
+			int solutions = Solve(s, options);
+			if (solutions != 0) {
+				printf("%s: a given of %d gave %d solutions\n", engineNames[e], value, solutions);
+				passed = false;
+				break;
+			}
+		}
+	}
+	return passed;
+}
+
+// Items that aren't valid reach done() with empty stats, on one thread and on several, even in a slot an earlier
+// puzzle's search has used
+static bool testBatchInvalidStats() {
+	bool passed = true;
+	for (int threads = 1; threads <= 2; threads++) {
+		size_t read = 0;
+		long long searched = 0;
+		auto next = [&](BatchItem& item) {
+			if (read == 30) return false;
+			// Every other item is an empty grid, which needs guessing to find two solutions
+			item.valid = read++ % 2 == 0;
+			item.shape(3, 3);
+			return true;
+		};
+		auto done = [&](BatchItem& item) {
+			if (item.valid) searched += item.stats.nodes;
+			else if (item.stats.nodes != 0 || item.stats.hardest != NakedSingle) {
+				printf("%d threads: item %zu isn't valid but has the stats of a search\n", threads, item.sequence);
+				passed = false;
+			}
+		};
+		// A window of 3 puts the items that aren't valid in slots that held a valid one before
+		solveBatch(threads, 3, next, done);
+		if (searched == 0) {
+			printf("%d threads: no search made any guesses, so nothing was checked\n", threads);
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+#ifndef _WIN32
+
+// Send a whole message and read back the next one. Returns false if the connection failed.
+static bool exchange(int fd, const std::vector<unsigned char>& out, std::vector<unsigned char>& reply) {
+	for (size_t at = 0; at < out.size();) {
+		ssize_t n = write(fd, out.data() + at, out.size() - at);
+		if (n <= 0) return false;
+		at += (size_t)n;
+	}
+	std::vector<unsigned char> in;
+	while (true) {
+		const unsigned char* payload;
+		size_t length;
+		bool tooLong;
+		if (nextMessage(in.data(), in.size(), payload, length, tooLong) > 0) {
+			reply.assign(payload, payload + length);
+			return true;
+		}
+		if (tooLong) return false;
+		unsigned char buffer[4096];
+		ssize_t n = read(fd, buffer, sizeof(buffer));
+		if (n <= 0) return false;
+		in.insert(in.end(), buffer, buffer + n);
+	}
+}
+
+// A request the server rejects is answered with its own box shape, not that of the request which last used the job
+static bool testServerInvalidShape() {
+	ServerOptions options;
+	options.threads = 1;
+	SolveServer server(options);
+	if (!server.listenTcp(0)) {
+		printf("could not listen on the loopback address\n");
+		return false;
+	}
+	std::thread serving([&] { server.run(); });
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons((uint16_t)server.port());
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bool passed = fd >= 0 && connect(fd, (sockaddr*)&address, sizeof(address)) == 0;
+	if (!passed) printf("could not connect to the server\n");
+
+	// A 9x9 first leaves its shape in the job, which the 9x9 boxes of the next request are too large to replace
+	SolveRequest request;
+	request.id = 1;
+	request.timeoutMs = 0;
+	request.firstSolution = false;
+	request.sudoku.reshape(3, 3);
+	std::vector<unsigned char> out, reply;
+	appendSolveRequest(request, out);
+	if (passed && (!exchange(fd, out, reply) || reply.size() < 8 || reply[1] != 2 || reply[2] != 3 || reply[3] != 3)) {
+		printf("the 9x9 request wasn't answered with 2 solutions\n");
+		passed = false;
+	}
+
+	request.id = 2;
+	request.sudoku.reshape(2, 2);
+	out.clear();
+	appendSolveRequest(request, out);
+	// The payload starts after the 4 byte length, with the box shape at bytes 2 and 3
+	out[6] = 9;
+	out[7] = 9;
+	if (passed && (!exchange(fd, out, reply) || reply.size() < 8 || reply[1] != ServerInvalid)) {
+		printf("the request for 9x9 boxes wasn't rejected\n");
+		passed = false;
+	}
+	else if (passed && (reply[2] != 9 || reply[3] != 9)) {
+		printf("the rejected request for 9x9 boxes was answered with %dx%d boxes\n", reply[2], reply[3]);
+		passed = false;
+	}
+
+	if (fd >= 0) close(fd);
+	server.stop();
+	serving.join();
+	return passed;
+}
+
+#endif
+
+struct Test {
+	const char* name;
+	bool (*run)();
+};
+
+static const Test tests[] = {
+	{ "text-round-trip", testTextRoundTrip },
+	{ "given-past-largest-digit", testGivenPastLargestDigit },
+	{ "batch-invalid-stats", testBatchInvalidStats },
+#ifndef _WIN32
+	{ "server-invalid-shape", testServerInvalidShape }
+#endif
+};
+
+int main(int argc, char* argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <test>\n\nTests:\n", argv[0]);
+		for (const Test& test : tests) fprintf(stderr, "  %s\n", test.name);
+		return 2;
+	}
+	for (const Test& test : tests) {
+		if (strcmp(argv[1], test.name) == 0) return test.run() ? 0 : 1;
+	}
+	fprintf(stderr, "Unknown test '%s'\n", argv[1]);
+	return 2;
+}